@@ -1,29 +1,47 @@
 #include "bsp.h"
+#include "parallel.h"
 #include <array>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
 
-VIdx BSP::create_vertex(float3 position)
+template<typename T, typename I>
+auto BSPT<T, I>::create_vertex(Vec3 position) -> VIdx
 {
     m_vertices.push_back({EIdx::invalid(), position});
-    return {(int)(m_vertices.size() - 1)};
+    return {(I)(m_vertices.size() - 1)};
 }
 
-PIdx BSP::create_polygon(std::span<const VIdx> indices)
+template<typename T, typename I>
+auto BSPT<T, I>::create_polygon(std::span<const VIdx> indices) -> PIdx
 {
-    PIdx polygon = (int)m_polygons.size();
+    if(indices.empty())
+        throw std::invalid_argument("polygon has no vertices");
 
-    EIdx first_edge = {(int)m_half_edges.size()};
-    int num_edges = indices.size();
+    // Checked before any slot is allocated, so a bad index leaves the free lists untouched
+    for(VIdx vertex : indices)
+        if(vertex.i < 0 || vertex.i >= (I)m_vertices.size())
+            throw std::invalid_argument("vertex does not exist");
 
-    m_polygons.push_back({
-        .edge=first_edge,
+    PIdx polygon = allocate_polygon();
+
+    // Slots come off the free lists first, so a polygon's edges need not be contiguous
+    I num_edges = (I)indices.size();
+    std::vector<EIdx> edges(num_edges);
+    for(I i = 0; i < num_edges; i++)
+        edges[i] = allocate_half_edge();
+
+    m_polygons.mut(polygon.i) = {
+        .edge=edges[0],
         .debug_highlight=false
-    });
+    };
 
-    for(int i = 0; i < num_edges; i++)
+    for(I i = 0; i < num_edges; i++)
     {
-        EIdx this_edge = first_edge.i + i;
-        EIdx prev_edge = first_edge.i + (i + num_edges - 1) % num_edges;
-        EIdx next_edge = first_edge.i + (i + 1) % num_edges;
+        EIdx this_edge = edges[i];
+        EIdx prev_edge = edges[(i + num_edges - 1) % num_edges];
+        EIdx next_edge = edges[(i + 1) % num_edges];
         VIdx vertex = indices[i];
         VIdx next_vertex = indices[(i + 1) % num_edges];
         EdgeId edge_id = {vertex, next_vertex};
@@ -33,33 +51,251 @@ PIdx BSP::create_polygon(std::span<const VIdx> indices)
 
         m_edge_map.insert({edge_id, this_edge});
 
-        m_half_edges.push_back({
+        m_half_edges.mut(this_edge.i) = {
             .twin = EIdx::invalid(),
              .next = next_edge,
              .prev = prev_edge,
             .polygon = polygon,
             .vertex = vertex,
-            .debug_highlight=false});
+            .debug_highlight=false};
 
         if(m_edge_map.contains(twin_edge_id))
         {
             EIdx twin_edge = m_edge_map.at(twin_edge_id);
-            m_half_edges[this_edge.i].twin = twin_edge;
-            m_half_edges[twin_edge.i].twin = this_edge;
+            m_half_edges.mut(this_edge.i).twin = twin_edge;
+            m_half_edges.mut(twin_edge.i).twin = this_edge;
         }
 
         if(!m_vertices[vertex.i].edge)
-            m_vertices[vertex.i].edge = this_edge;
+            m_vertices.mut(vertex.i).edge = this_edge;
     }
 
     return polygon;
 }
 
-std::shared_ptr<BSP> BSP::cube(float3 size, bool center)
+template<typename T, typename I>
+auto BSPT<T, I>::allocate_half_edge() -> EIdx
+{
+    size_t num_free = m_free_half_edges.size();
+    if(num_free == 0)
+    {
+        m_half_edges.push_back(HalfEdge{});
+        return {(I)(m_half_edges.size() - 1)};
+    }
+    EIdx res = m_free_half_edges[num_free - 1];
+    m_free_half_edges.resize(num_free - 1);
+    return res;
+}
+
+template<typename T, typename I>
+auto BSPT<T, I>::allocate_polygon() -> PIdx
+{
+    size_t num_free = m_free_polygons.size();
+    if(num_free == 0)
+    {
+        m_polygons.push_back(Polygon{});
+        return {(I)(m_polygons.size() - 1)};
+    }
+    PIdx res = m_free_polygons[num_free - 1];
+    m_free_polygons.resize(num_free - 1);
+    return res;
+}
+
+template<typename T, typename I>
+void BSPT<T, I>::delete_polygon(PIdx polygon_idx)
+{
+    if(polygon_idx.i < 0 || polygon_idx.i >= (I)m_polygons.size() || is_deleted(polygon_idx))
+        throw std::invalid_argument("polygon does not exist");
+
+    std::vector<EIdx> edges;
+    EIdx first_edge_idx = get_polygon(polygon_idx).edge;
+    EIdx curr_edge_idx = first_edge_idx;
+    do
+    {
+        edges.push_back(curr_edge_idx);
+        curr_edge_idx = m_half_edges[curr_edge_idx.i].next;
+    } while (curr_edge_idx != first_edge_idx);
+
+    // Only the neighbours are written here, so this polygon's own edges can still be read as is
+    auto neighbour = [&](EIdx edge_idx) {
+        return edge_idx && m_half_edges[edge_idx.i].polygon != polygon_idx;
+    };
+    for(EIdx edge_idx : edges)
+    {
+        HalfEdge edge = m_half_edges[edge_idx.i];
+        EdgeId edge_id = {edge.vertex, m_half_edges[edge.next.i].vertex};
+        if(m_edge_map.contains(edge_id) && m_edge_map.at(edge_id) == edge_idx)
+            m_edge_map.erase(edge_id);
+
+        if(neighbour(edge.twin))
+            m_half_edges.mut(edge.twin.i).twin = EIdx::invalid();
+
+        // Hand the vertex another of its outgoing edges, if a neighbouring polygon has one
+        if(m_vertices[edge.vertex.i].edge == edge_idx)
+        {
+            EIdx prev_twin = m_half_edges[edge.prev.i].twin;
+            EIdx replacement = EIdx::invalid();
+            if(neighbour(prev_twin))
+                replacement = prev_twin;
+            else if(neighbour(edge.twin))
+                replacement = m_half_edges[edge.twin.i].next;
+            m_vertices.mut(edge.vertex.i).edge = replacement;
+        }
+    }
+
+    for(EIdx edge_idx : edges)
+    {
+        m_half_edges.mut(edge_idx.i) = HalfEdge{};
+        m_free_half_edges.push_back(edge_idx);
+    }
+    m_polygons.mut(polygon_idx.i) = Polygon{};
+    m_free_polygons.push_back(polygon_idx);
+}
+
+template<typename T, typename I>
+void BSPT<T, I>::compact()
+{
+    const BSPT& self = *this;
+
+    // Live polygons keep their relative order
+    std::vector<PIdx> polygon_order;
+    std::vector<I> polygon_remap(m_polygons.size(), -1);
+    for(I i = 0; i < (I)m_polygons.size(); i++)
+    {
+        if(!is_deleted(PIdx(i)))
+        {
+            polygon_remap[i] = (I)polygon_order.size();
+            polygon_order.push_back(PIdx(i));
+        }
+    }
+    I num_polygons = (I)polygon_order.size();
+
+    // Offset of every polygon's loop in the new half edge array
+    std::vector<I> first_edge(num_polygons + 1, 0);
+    parallel_for(num_polygons, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++)
+        {
+            EIdx first_edge_idx = self.get_polygon(polygon_order[i]).edge;
+            EIdx curr_edge_idx = first_edge_idx;
+            do
+            {
+                first_edge[i + 1]++;
+                curr_edge_idx = self.get_edge(curr_edge_idx).next;
+            } while (curr_edge_idx != first_edge_idx);
+        }
+    });
+    for(I i = 0; i < num_polygons; i++)
+        first_edge[i + 1] += first_edge[i];
+    I num_edges = first_edge[num_polygons];
+
+    std::vector<EIdx> edge_order(num_edges);
+    std::vector<I> edge_remap(m_half_edges.size(), -1);
+    parallel_for(num_polygons, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++)
+        {
+            I j = first_edge[i];
+            EIdx first_edge_idx = self.get_polygon(polygon_order[i]).edge;
+            EIdx curr_edge_idx = first_edge_idx;
+            do
+            {
+                edge_order[j] = curr_edge_idx;
+                edge_remap[curr_edge_idx.i] = j++;
+                curr_edge_idx = self.get_edge(curr_edge_idx).next;
+            } while (curr_edge_idx != first_edge_idx);
+        }
+    });
+
+    // Each vertex keeps the first edge that reaches it as its outgoing edge
+    std::vector<VIdx> vertex_order;
+    std::vector<EIdx> vertex_edge;
+    std::vector<I> vertex_remap(m_vertices.size(), -1);
+    for(I j = 0; j < num_edges; j++)
+    {
+        VIdx v = self.get_edge(edge_order[j]).vertex;
+        if(vertex_remap[v.i] == -1)
+        {
+            vertex_remap[v.i] = (I)vertex_order.size();
+            vertex_order.push_back(v);
+            vertex_edge.push_back(EIdx(j));
+        }
+    }
+    I num_vertices = (I)vertex_order.size();
+
+    // Gather the survivors into fresh arrays. These share no chunks, so distinct elements can be
+    // written from several threads.
+    ChunkedVector<Vertex> vertices;
+    ChunkedVector<HalfEdge> half_edges;
+    ChunkedVector<Polygon> polygons;
+    vertices.resize(num_vertices);
+    half_edges.resize(num_edges);
+    polygons.resize(num_polygons);
+
+    auto remap = [](const std::vector<I>& table, I i) {
+        return i < 0 ? i : table[i];
+    };
+    parallel_for(num_vertices, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++)
+        {
+            Vertex& vertex = vertices.mut(i);
+            vertex = self.get_vertex(vertex_order[i]);
+            vertex.edge = vertex_edge[i];
+        }
+    });
+    parallel_for(num_edges, [&](size_t begin, size_t end) {
+        for(size_t j = begin; j < end; j++)
+        {
+            HalfEdge& edge = half_edges.mut(j);
+            edge = self.get_edge(edge_order[j]);
+            edge.twin = remap(edge_remap, edge.twin.i);
+            edge.next = remap(edge_remap, edge.next.i);
+            edge.prev = remap(edge_remap, edge.prev.i);
+            edge.polygon = remap(polygon_remap, edge.polygon.i);
+            edge.vertex = remap(vertex_remap, edge.vertex.i);
+        }
+    });
+    parallel_for(num_polygons, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++)
+        {
+            Polygon& polygon = polygons.mut(i);
+            polygon = self.get_polygon(polygon_order[i]);
+            polygon.edge = first_edge[i];
+        }
+    });
+
+    for(size_t i = 0; i < m_nodes.size(); i++)
+    {
+        Node node = m_nodes[i];
+        std::vector<PIdx> node_polygons;
+        for(PIdx polygon_idx : node.polygons)
+        {
+            if(polygon_remap[polygon_idx.i] != -1)
+                node_polygons.push_back(polygon_remap[polygon_idx.i]);
+        }
+        node.polygons = std::move(node_polygons);
+        m_nodes.mut(i) = std::move(node);
+    }
+
+    ChunkedMap<EdgeId, EIdx, EdgeIdHashT<I>> edge_map;
+    for(I j = 0; j < num_edges; j++)
+    {
+        const HalfEdge& edge = half_edges[j];
+        edge_map.insert({{edge.vertex, half_edges[edge.next.i].vertex}, EIdx(j)});
+    }
+
+    m_vertices = std::move(vertices);
+    m_half_edges = std::move(half_edges);
+    m_polygons = std::move(polygons);
+    m_edge_map = std::move(edge_map);
+    m_free_half_edges.clear();
+    m_free_polygons.clear();
+}
+
+template<typename T, typename I>
+std::shared_ptr<BSPT<T, I>> BSPT<T, I>::cube(Vec3 size, bool center)
 {
-    auto res = std::make_shared<BSP>();
+    auto res = std::make_shared<BSPT>();
 
-    auto min = float3(0,0,0);
+    auto min = Vec3(0,0,0);
     auto max = size;
     if(center)
     {
@@ -88,70 +324,146 @@ std::shared_ptr<BSP> BSP::cube(float3 size, bool center)
     return res;
 }
 
-std::shared_ptr<Mesh> BSP::to_tri_mesh() const
+template<typename T, typename I>
+void BSPT<T, I>::append_tri_mesh(Mesh& mesh, I first_polygon, I end_polygon) const
 {
-    std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
-
-    for (auto& polygon : m_polygons)
+    for (I polygon_idx = first_polygon; polygon_idx < end_polygon; polygon_idx++)
     {
-        int first_position = mesh->positions.size();
+        const Polygon& polygon = m_polygons[polygon_idx];
+        if(!polygon.edge)
+            continue;
+        int first_position = mesh.positions.size();
 
         auto e = get_edge(polygon.edge);
         while(true)
         {
-            mesh->positions.push_back(get_vertex(e.vertex).position);
+            mesh.positions.push_back(get_vertex(e.vertex).position.template cast<float>());
             if(e.next == polygon.edge)
                 break;
             e = get_edge(e.next);
         }
 
-        float3 n = float3::cross(mesh->positions[first_position + 1] - mesh->positions[first_position], mesh->positions[first_position + 2] - mesh->positions[first_position]);
-        n = float3::normalize(n);
+        // Normal from the full precision positions, as large coordinates lose too much in float
+        const HalfEdge& e0 = get_edge(polygon.edge);
+        const HalfEdge& e1 = get_edge(e0.next);
+        Vec3 p0 = get_vertex(e0.vertex).position;
+        Vec3 p1 = get_vertex(e1.vertex).position;
+        Vec3 p2 = get_vertex(get_edge(e1.next).vertex).position;
+        float3 n = Vec3::normalize(Vec3::cross(p1 - p0, p2 - p0)).template cast<float>();
 
-        for(int i = first_position; i < mesh->positions.size(); i++)
+        for(int i = first_position; i < mesh.positions.size(); i++)
         {
-            mesh->normals.push_back(n);
+            mesh.normals.push_back(n);
             if (polygon.debug_highlight)
-                mesh->colors.push_back(float3(1, 0, 0));
+                mesh.colors.push_back(float3(1, 0, 0));
             else
-                mesh->colors.push_back(float3(1, 1, 1));
+                mesh.colors.push_back(float3(1, 1, 1));
         }
 
-        int num_positions = mesh->positions.size() - first_position;
+        int num_positions = mesh.positions.size() - first_position;
 
         int top = 0;
         int bottom = num_positions - 1;
         bool even = true;
 
-        mesh->indices.push_back(first_position + top);
-        mesh->indices.push_back(first_position + top + 1);
-        mesh->indices.push_back(first_position + bottom);
+        mesh.indices.push_back(first_position + top);
+        mesh.indices.push_back(first_position + top + 1);
+        mesh.indices.push_back(first_position + bottom);
         top++;
 
         while((bottom - top) >= 2)
         {
             if(even)
             {
-                mesh->indices.push_back(first_position + top);
-                mesh->indices.push_back(first_position + top + 1);
-                mesh->indices.push_back(first_position + bottom);
+                mesh.indices.push_back(first_position + top);
+                mesh.indices.push_back(first_position + top + 1);
+                mesh.indices.push_back(first_position + bottom);
                 top++;
             }
             else
             {
-                mesh->indices.push_back(first_position + bottom);
-                mesh->indices.push_back(first_position + top);
-                mesh->indices.push_back(first_position + bottom - 1);
+                mesh.indices.push_back(first_position + bottom);
+                mesh.indices.push_back(first_position + top);
+                mesh.indices.push_back(first_position + bottom - 1);
                 bottom--;
             }
             even = !even;
         }
     }
+}
 
+template<typename T, typename I>
+std::shared_ptr<Mesh> BSPT<T, I>::to_tri_mesh() const
+{
+    std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+    append_tri_mesh(*mesh, 0, (I)m_polygons.size());
     return mesh;
 }
 
-std::shared_ptr<Mesh> BSP::to_edge_mesh() const
+template<typename T, typename I>
+std::shared_ptr<MeshStreamT<T, I>> BSPT<T, I>::to_tri_mesh_chunks(size_t polygons_per_chunk) const
+{
+    return std::make_shared<MeshStreamT<T, I>>(snapshot(), polygons_per_chunk);
+}
+
+template<typename T, typename I>
+MeshStreamT<T, I>::MeshStreamT(std::shared_ptr<const BSPT<T, I>> bsp, size_t polygons_per_chunk)
+    : m_bsp(std::move(bsp))
+    , m_polygons_per_chunk(polygons_per_chunk)
+{
+    if (m_polygons_per_chunk == 0)
+        throw std::invalid_argument("polygons_per_chunk must be positive");
+    m_chunk_count = (m_bsp->polygons().size() + m_polygons_per_chunk - 1) / m_polygons_per_chunk;
+    if (m_chunk_count > 0)
+        start(0);
+}
+
+template<typename T, typename I>
+MeshStreamT<T, I>::~MeshStreamT()
+{
+    if (m_pending.valid())
+        m_pending.wait();
+}
+
+template<typename T, typename I>
+std::shared_ptr<Mesh> MeshStreamT<T, I>::next()
+{
+    if (!m_pending.valid())
+        return nullptr;
+
+    // Rethrows anything the worker threw
+    m_pending.get();
+
+    size_t chunk = m_next_chunk++;
+    if (m_next_chunk < m_chunk_count)
+        start(m_next_chunk);
+    return m_buffers[chunk & 1];
+}
+
+template<typename T, typename I>
+void MeshStreamT<T, I>::start(size_t chunk)
+{
+    m_pending = std::async(std::launch::async, [this, chunk]() {
+        // Only this thread and the caller's references can own the buffer, and the caller
+        // can't gain new ones until the chunk is handed out, so a unique buffer stays unique
+        std::shared_ptr<Mesh>& buffer = m_buffers[chunk & 1];
+        if (!buffer || buffer.use_count() > 1)
+            buffer = std::make_shared<Mesh>();
+
+        buffer->positions.clear();
+        buffer->normals.clear();
+        buffer->colors.clear();
+        buffer->indices.clear();
+
+        size_t first_polygon = chunk * m_polygons_per_chunk;
+        size_t end_polygon = std::min(first_polygon + m_polygons_per_chunk, m_bsp->polygons().size());
+        m_bsp->append_tri_mesh(*buffer, (I)first_polygon, (I)end_polygon);
+    });
+}
+
+
+template<typename T, typename I>
+std::shared_ptr<Mesh> BSPT<T, I>::to_edge_mesh() const
 {
     std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
 
@@ -177,17 +489,19 @@ std::shared_ptr<Mesh> BSP::to_edge_mesh() const
     }*/
 
     for (auto& _edge : m_half_edges) {
+        if (!_edge.polygon)
+            continue;
         float3 col = _edge.debug_highlight ? float3(1, 0, 0) : float3(0, 0, 0);
 
         {
-            mesh->positions.push_back(get_vertex(_edge.vertex).position);
+            mesh->positions.push_back(get_vertex(_edge.vertex).position.template cast<float>());
             mesh->normals.push_back(float3());
             mesh->colors.push_back(col);
             mesh->indices.push_back(mesh->positions.size() - 1);
         }
 
         {
-            mesh->positions.push_back(get_vertex(get_edge(_edge.next).vertex).position);
+            mesh->positions.push_back(get_vertex(get_edge(_edge.next).vertex).position.template cast<float>());
             mesh->normals.push_back(float3());
             mesh->colors.push_back(col);
             mesh->indices.push_back(mesh->positions.size() - 1);
@@ -199,7 +513,8 @@ std::shared_ptr<Mesh> BSP::to_edge_mesh() const
 
 
 
-void BSP::split(
+template<typename T, typename I>
+void BSPT<T, I>::split(
     std::vector<PIdx> polygons,
     const Plane& plane,
     std::vector<PIdx>& coplanar,
@@ -212,10 +527,15 @@ void BSP::split(
     for(PIdx& polygon_idx : polygons)
     {
         Polygon& polygon = get_polygon(polygon_idx);
-        polygon.split_id_0 = INT32_MIN;
-        polygon.split_id_1 = INT32_MAX;
+        polygon.split_id_0 = std::numeric_limits<I>::min();
+        polygon.split_id_1 = std::numeric_limits<I>::max();
     }
 
+    // Classify every vertex once rather than testing both ends of every edge
+    std::vector<T> distances(m_vertices.size());
+    for(size_t i = 0; i < m_vertices.size(); i++)
+        distances[i] = plane.distance(m_vertices[i].position);
+
     for(PIdx& polygon_idx : polygons)
     {
         Polygon& polygon = get_polygon(polygon_idx);
@@ -223,18 +543,17 @@ void BSP::split(
         EIdx curr_edge_idx = first_edge_idx;
         do
         {
-            HalfEdge& edge = get_edge(curr_edge_idx);
+            // Read through the const accessors so unaffected chunks stay shared with snapshots
+            const HalfEdge& edge = m_half_edges[curr_edge_idx.i];
             EIdx next_edge_index = edge.next;
             if (!edge.twin || curr_edge_idx < edge.twin) {
-                float3 v0 =   get_vertex(edge.vertex).position;
-                float3 v1 = get_vertex(get_edge(next_edge_index).vertex).position;
-                float d0 = plane.distance(v0);
-                float d1 = plane.distance(v1);
+                T d0 = distances[edge.vertex.i];
+                T d1 = distances[m_half_edges[next_edge_index.i].vertex.i];
                 if(d0 * d1 < 0)
                 {
                     edges_to_split.push_back(curr_edge_idx);
 
-                    edge.debug_highlight = true;
+                    get_edge(curr_edge_idx).debug_highlight = true;
                     polygon.debug_highlight = true;
                     polygon.split_id_0 = std::min(polygon.split_id_0, curr_edge_idx.i);
                     polygon.split_id_1 = std::max(polygon.split_id_1, curr_edge_idx.i);
@@ -255,3 +574,1033 @@ void BSP::split(
     }
 
 }
+
+
+namespace
+{
+    template<typename T, typename I>
+    struct PolygonInfo
+    {
+        vec3<T> normal;
+        T d;
+        T area;
+        bool sliver;
+        EIdxT<I> longest_edge;
+    };
+
+    // Output face of the simplify pass, as a loop of vertices plus the polygon attributes. Source
+    // is the polygon it was traced from, or the seed of the region it was merged from.
+    template<typename I>
+    struct Loop
+    {
+        std::vector<VIdxT<I>> vertices;
+        bool debug_highlight;
+        PIdxT<I> source;
+    };
+
+    // Newell's method, which gives a sensible plane for any planar polygon regardless of winding
+    // or collinear vertices.
+    template<typename T>
+    vec3<T> newell_normal(const std::vector<vec3<T>>& positions)
+    {
+        vec3<T> n = {0, 0, 0};
+        for(size_t i = 0; i < positions.size(); i++)
+            n += vec3<T>::cross(positions[i], positions[(i + 1) % positions.size()]);
+        return n;
+    }
+
+    template<typename T, typename I>
+    std::vector<vec3<T>> loop_positions(const BSPT<T, I>& bsp, const std::vector<VIdxT<I>>& vertices)
+    {
+        std::vector<vec3<T>> positions;
+        positions.reserve(vertices.size());
+        for(VIdxT<I> v : vertices)
+            positions.push_back(bsp.get_vertex(v).position);
+        return positions;
+    }
+
+    template<typename T, typename I>
+    std::vector<VIdxT<I>> polygon_vertices(const BSPT<T, I>& bsp, PIdxT<I> polygon_idx)
+    {
+        std::vector<VIdxT<I>> vertices;
+        EIdxT<I> first_edge_idx = bsp.get_polygon(polygon_idx).edge;
+        EIdxT<I> curr_edge_idx = first_edge_idx;
+        do
+        {
+            const HalfEdgeT<I>& edge = bsp.get_edge(curr_edge_idx);
+            vertices.push_back(edge.vertex);
+            curr_edge_idx = edge.next;
+        } while (curr_edge_idx != first_edge_idx);
+        return vertices;
+    }
+
+    template<typename T, typename I>
+    PolygonInfo<T, I> polygon_info(const BSPT<T, I>& bsp, PIdxT<I> polygon_idx)
+    {
+        PolygonInfo<T, I> info = {{0, 0, 0}, 0, 0, false, EIdxT<I>::invalid()};
+
+        std::vector<vec3<T>> positions;
+        vec3<T> centre = {0, 0, 0};
+        T perimeter = 0;
+        T longest = -1;
+        EIdxT<I> first_edge_idx = bsp.get_polygon(polygon_idx).edge;
+        EIdxT<I> curr_edge_idx = first_edge_idx;
+        do
+        {
+            const HalfEdgeT<I>& edge = bsp.get_edge(curr_edge_idx);
+            vec3<T> p = bsp.get_vertex(edge.vertex).position;
+            T len = vec3<T>::length(bsp.get_vertex(bsp.get_edge(edge.next).vertex).position - p);
+            if(len > longest)
+            {
+                longest = len;
+                info.longest_edge = curr_edge_idx;
+            }
+            perimeter += len;
+            centre += p;
+            positions.push_back(p);
+            curr_edge_idx = edge.next;
+        } while (curr_edge_idx != first_edge_idx);
+
+        vec3<T> n = newell_normal(positions);
+        T len = vec3<T>::length(n);
+        info.area = len / 2;
+        info.sliver = info.area <= geometry_epsilon<T> * perimeter * perimeter;
+        if(len > 0)
+        {
+            info.normal = n / len;
+            info.d = vec3<T>::dot(info.normal, centre / (T)positions.size());
+        }
+        return info;
+    }
+
+    // Both tests measure how far b is from the chord a-c, relative to the chord length, so they
+    // agree with each other on nearly straight outlines.
+    template<typename T>
+    bool is_collinear(const vec3<T>& a, const vec3<T>& b, const vec3<T>& c)
+    {
+        vec3<T> ac = c - a;
+        T tolerance = geometry_epsilon<T> * vec3<T>::dot(ac, ac);
+        return vec3<T>::length(vec3<T>::cross(b - a, ac)) <= tolerance && vec3<T>::dot(b - a, c - b) >= 0;
+    }
+
+    template<typename T>
+    bool is_convex(const std::vector<vec3<T>>& positions, const vec3<T>& normal)
+    {
+        size_t n = positions.size();
+        for(size_t i = 0; i < n; i++)
+        {
+            const vec3<T>& a = positions[(i + n - 1) % n];
+            const vec3<T>& b = positions[i];
+            const vec3<T>& c = positions[(i + 1) % n];
+            vec3<T> ac = c - a;
+            if(vec3<T>::dot(vec3<T>::cross(b - a, ac), normal) < -geometry_epsilon<T> * vec3<T>::dot(ac, ac))
+                return false;
+        }
+        return true;
+    }
+
+    template<typename I>
+    I find_root(std::vector<I>& parents, I i)
+    {
+        while(parents[i] != i)
+        {
+            parents[i] = parents[parents[i]];
+            i = parents[i];
+        }
+        return i;
+    }
+
+    // Traces the boundary of a region of coplanar polygons. Fails if the boundary is not a single
+    // simple convex loop (holes, pinched vertices or concave outlines), as the result could not be
+    // stored or triangulated as one polygon.
+    template<typename T, typename I>
+    bool merge_region(
+        const BSPT<T, I>& bsp,
+        const std::vector<I>& region_of,
+        I region,
+        const std::vector<PIdxT<I>>& polygons,
+        const vec3<T>& normal,
+        std::vector<VIdxT<I>>& vertices
+    )
+    {
+        auto is_boundary = [&](const HalfEdgeT<I>& edge) {
+            return !edge.twin || region_of[bsp.get_edge(edge.twin).polygon.i] != region;
+        };
+
+        EIdxT<I> start_edge_idx;
+        I num_region_edges = 0;
+        I num_boundary_edges = 0;
+        for(PIdxT<I> polygon_idx : polygons)
+        {
+            EIdxT<I> first_edge_idx = bsp.get_polygon(polygon_idx).edge;
+            EIdxT<I> curr_edge_idx = first_edge_idx;
+            do
+            {
+                const HalfEdgeT<I>& edge = bsp.get_edge(curr_edge_idx);
+                if(is_boundary(edge))
+                {
+                    num_boundary_edges++;
+                    if(!start_edge_idx)
+                        start_edge_idx = curr_edge_idx;
+                }
+                num_region_edges++;
+                curr_edge_idx = edge.next;
+            } while (curr_edge_idx != first_edge_idx);
+        }
+        if(!start_edge_idx)
+            return false;
+
+        EIdxT<I> curr_edge_idx = start_edge_idx;
+        do
+        {
+            vertices.push_back(bsp.get_edge(curr_edge_idx).vertex);
+            if((I)vertices.size() > num_boundary_edges)
+                return false;
+
+            // Rotate around the end vertex across interior edges until we reach the next boundary edge
+            EIdxT<I> next_edge_idx = bsp.get_edge(curr_edge_idx).next;
+            for(I steps = 0; !is_boundary(bsp.get_edge(next_edge_idx)); steps++)
+            {
+                if(steps > num_region_edges)
+                    return false;
+                next_edge_idx = bsp.get_edge(bsp.get_edge(next_edge_idx).twin).next;
+            }
+            curr_edge_idx = next_edge_idx;
+        } while (curr_edge_idx != start_edge_idx);
+
+        if((I)vertices.size() != num_boundary_edges)
+            return false;
+
+        std::vector<VIdxT<I>> sorted = vertices;
+        std::sort(sorted.begin(), sorted.end());
+        if(std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end())
+            return false;
+
+        return is_convex(loop_positions(bsp, vertices), normal);
+    }
+}
+
+template<typename T, typename I>
+I BSPT<T, I>::simplify()
+{
+    // The passes below index every slot, so tombstones have to go first
+    if(!m_free_half_edges.empty() || !m_free_polygons.empty())
+        compact();
+
+    const BSPT& self = *this;
+    I num_polygons = (I)m_polygons.size();
+    I num_edges = (I)m_half_edges.size();
+    I num_vertices = (I)m_vertices.size();
+
+    std::vector<PolygonInfo<T, I>> infos(num_polygons);
+    parallel_for(num_polygons, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++)
+            infos[i] = polygon_info(self, PIdx((I)i));
+    });
+
+    // Slivers are merged into the polygon across their longest edge rather than deleted, which
+    // would leave a crack. Any resulting concavity is caught by the convexity test below.
+    auto can_merge = [&](EIdx edge_idx, PIdx a, PIdx b) {
+        const PolygonInfo<T, I>& ia = infos[a.i];
+        const PolygonInfo<T, I>& ib = infos[b.i];
+        if(self.get_polygon(a).debug_highlight != self.get_polygon(b).debug_highlight)
+            return false;
+        if(ia.sliver && ia.longest_edge == edge_idx)
+            return true;
+        return !ia.sliver && !ib.sliver
+            && Vec3::dot(ia.normal, ib.normal) >= 1 - geometry_epsilon<T>
+            && std::abs(ia.d - ib.d) <= geometry_epsilon<T> * std::max(T(1), std::abs(ia.d));
+    };
+
+    // Flag every half edge whose polygon should be merged with its twin's polygon
+    std::vector<char> merge_edge(num_edges, 0);
+    parallel_for(num_edges, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++)
+        {
+            const HalfEdge& edge = self.get_edge(EIdx((I)i));
+            if(!edge.twin)
+                continue;
+            const HalfEdge& twin = self.get_edge(edge.twin);
+            merge_edge[i] = (edge.polygon < twin.polygon && can_merge(EIdx((I)i), edge.polygon, twin.polygon))
+                || can_merge(edge.twin, twin.polygon, edge.polygon);
+        }
+    });
+
+    // Union the flagged polygon pairs into regions
+    std::vector<I> parents(num_polygons);
+    for(I i = 0; i < num_polygons; i++)
+        parents[i] = i;
+    for(I i = 0; i < num_edges; i++)
+    {
+        if(!merge_edge[i])
+            continue;
+        const HalfEdge& edge = self.get_edge(EIdx(i));
+        I a = find_root(parents, edge.polygon.i);
+        I b = find_root(parents, self.get_edge(edge.twin).polygon.i);
+        if(a != b)
+            parents[std::max(a, b)] = std::min(a, b);
+    }
+
+    std::vector<std::vector<PIdx>> components;
+    std::vector<I> root_component(num_polygons, -1);
+    for(I i = 0; i < num_polygons; i++)
+    {
+        I root = find_root(parents, i);
+        if(root_component[root] == -1)
+        {
+            root_component[root] = (I)components.size();
+            components.emplace_back();
+        }
+        components[root_component[root]].push_back(PIdx(i));
+    }
+
+    // Pairwise matches chain along gently curved surfaces, so every component is split into
+    // regions grown from a seed polygon, taking only polygons whose vertices all lie on the seed's
+    // plane. Seeds are picked largest first and a region is identified by its seed.
+    Vec3 min_position = Vec3(1, 1, 1) * std::numeric_limits<T>::max();
+    Vec3 max_position = min_position * T(-1);
+    for(const Vertex& vertex : m_vertices)
+    {
+        min_position = {std::min(min_position.x, vertex.position.x), std::min(min_position.y, vertex.position.y), std::min(min_position.z, vertex.position.z)};
+        max_position = {std::max(max_position.x, vertex.position.x), std::max(max_position.y, vertex.position.y), std::max(max_position.z, vertex.position.z)};
+    }
+    T tolerance = geometry_epsilon<T> * (num_polygons ? std::max(T(1), Vec3::length(max_position - min_position)) : T(1));
+
+    auto on_plane = [&](PIdx polygon_idx, const PolygonInfo<T, I>& plane) {
+        EIdx first_edge_idx = self.get_polygon(polygon_idx).edge;
+        EIdx curr_edge_idx = first_edge_idx;
+        do
+        {
+            const HalfEdge& edge = self.get_edge(curr_edge_idx);
+            if(std::abs(Vec3::dot(plane.normal, self.get_vertex(edge.vertex).position) - plane.d) > tolerance)
+                return false;
+            curr_edge_idx = edge.next;
+        } while (curr_edge_idx != first_edge_idx);
+        return true;
+    };
+
+    std::vector<I> region_of(num_polygons, -1);
+    parallel_for(components.size(), [&](size_t begin, size_t end) {
+        std::vector<PIdx> stack;
+        for(size_t c = begin; c < end; c++)
+        {
+            std::vector<PIdx>& component = components[c];
+            std::stable_sort(component.begin(), component.end(), [&](PIdx a, PIdx b) {
+                return infos[a.i].area > infos[b.i].area;
+            });
+            for(PIdx seed : component)
+            {
+                if(region_of[seed.i] != -1)
+                    continue;
+                region_of[seed.i] = seed.i;
+                if(infos[seed.i].sliver)
+                    continue;
+
+                stack.assign(1, seed);
+                while(!stack.empty())
+                {
+                    PIdx polygon_idx = stack.back();
+                    stack.pop_back();
+                    EIdx first_edge_idx = self.get_polygon(polygon_idx).edge;
+                    EIdx curr_edge_idx = first_edge_idx;
+                    do
+                    {
+                        const HalfEdge& edge = self.get_edge(curr_edge_idx);
+                        if(edge.twin && (merge_edge[curr_edge_idx.i] || merge_edge[edge.twin.i]))
+                        {
+                            PIdx other = self.get_edge(edge.twin).polygon;
+                            if(region_of[other.i] == -1 && on_plane(other, infos[seed.i]))
+                            {
+                                region_of[other.i] = seed.i;
+                                stack.push_back(other);
+                            }
+                        }
+                        curr_edge_idx = edge.next;
+                    } while (curr_edge_idx != first_edge_idx);
+                }
+            }
+        }
+    }, 64);
+
+    std::vector<std::vector<PIdx>> regions;
+    std::vector<I> seed_region(num_polygons, -1);
+    for(I i = 0; i < num_polygons; i++)
+    {
+        I seed = region_of[i];
+        if(seed_region[seed] == -1)
+        {
+            seed_region[seed] = (I)regions.size();
+            regions.emplace_back();
+        }
+        regions[seed_region[seed]].push_back(PIdx(i));
+    }
+
+    // Trace every region's outline independently. Regions that can't become a single polygon keep
+    // their original polygons.
+    std::vector<std::vector<Loop<I>>> region_loops(regions.size());
+    std::vector<char> merged(num_polygons, 0);
+    parallel_for(regions.size(), [&](size_t begin, size_t end) {
+        for(size_t r = begin; r < end; r++)
+        {
+            const std::vector<PIdx>& polygons = regions[r];
+            PIdx seed = region_of[polygons[0].i];
+            bool debug_highlight = self.get_polygon(seed).debug_highlight;
+            if(polygons.size() > 1)
+            {
+                Loop<I> loop = {{}, debug_highlight, seed};
+                if(merge_region(self, region_of, seed.i, polygons, infos[seed.i].normal, loop.vertices))
+                {
+                    merged[seed.i] = 1;
+                    region_loops[r].push_back(std::move(loop));
+                    continue;
+                }
+            }
+            for(PIdx polygon_idx : polygons)
+                region_loops[r].push_back({polygon_vertices(self, polygon_idx), self.get_polygon(polygon_idx).debug_highlight, polygon_idx});
+        }
+    }, 64);
+
+    std::vector<Loop<I>> loops;
+    for(std::vector<Loop<I>>& r : region_loops)
+        for(Loop<I>& loop : r)
+            loops.push_back(std::move(loop));
+
+    // Remove collinear vertices until nothing changes, dropping loops that collapse. A vertex is
+    // only removed when it is collinear in every loop using it and at most two loops use it, i.e.
+    // it lies in the middle of a straight edge, so neighbouring polygons stay consistent.
+    std::vector<I> usage(num_vertices);
+    while(true)
+    {
+        std::vector<char> keep_loop(loops.size());
+        std::vector<std::vector<char>> collinear(loops.size());
+        parallel_for(loops.size(), [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; i++)
+            {
+                std::vector<Vec3> positions = loop_positions(self, loops[i].vertices);
+                keep_loop[i] = positions.size() >= 3;
+                size_t n = positions.size();
+                collinear[i].resize(n);
+                for(size_t j = 0; j < n; j++)
+                    collinear[i][j] = is_collinear(positions[(j + n - 1) % n], positions[j], positions[(j + 1) % n]);
+            }
+        }, 256);
+
+        std::fill(usage.begin(), usage.end(), 0);
+        std::vector<I> collinear_usage(num_vertices);
+        for(size_t i = 0; i < loops.size(); i++)
+        {
+            if(!keep_loop[i])
+                continue;
+            for(size_t j = 0; j < loops[i].vertices.size(); j++)
+            {
+                usage[loops[i].vertices[j].i]++;
+                collinear_usage[loops[i].vertices[j].i] += collinear[i][j];
+            }
+        }
+
+        bool changed = false;
+        std::vector<Loop<I>> next_loops;
+        for(size_t i = 0; i < loops.size(); i++)
+        {
+            if(!keep_loop[i])
+            {
+                changed = true;
+                continue;
+            }
+            Loop<I> loop = {{}, loops[i].debug_highlight, loops[i].source};
+            for(size_t j = 0; j < loops[i].vertices.size(); j++)
+            {
+                VIdx v = loops[i].vertices[j];
+                if(collinear[i][j] && collinear_usage[v.i] == usage[v.i] && usage[v.i] <= 2)
+                    changed = true;
+                else
+                    loop.vertices.push_back(v);
+            }
+            next_loops.push_back(std::move(loop));
+        }
+        loops = std::move(next_loops);
+        if(!changed)
+            break;
+    }
+
+    // Rebuild compacted arrays from the remaining loops
+    BSPT res;
+    std::vector<VIdx> vertex_remap(num_vertices);
+    for(I i = 0; i < num_vertices; i++)
+    {
+        if(usage[i] > 0)
+            vertex_remap[i] = res.create_vertex(get_vertex(VIdx(i)).position);
+    }
+    std::vector<VIdx> vertices;
+    std::vector<I> source_polygon(num_polygons, -1);
+    for(const Loop<I>& loop : loops)
+    {
+        vertices.clear();
+        for(VIdx v : loop.vertices)
+            vertices.push_back(vertex_remap[v.i]);
+        PIdx polygon_idx = res.create_polygon(vertices);
+        res.get_polygon(polygon_idx).debug_highlight = loop.debug_highlight;
+        source_polygon[loop.source.i] = polygon_idx.i;
+    }
+
+    // Nodes follow their polygons into the merged faces, and lose those that collapsed
+    for(size_t i = 0; i < m_nodes.size(); i++)
+    {
+        Node node = m_nodes[i];
+        std::vector<PIdx> node_polygons;
+        for(PIdx polygon_idx : node.polygons)
+        {
+            I source = merged[region_of[polygon_idx.i]] ? region_of[polygon_idx.i] : polygon_idx.i;
+            PIdx res_polygon_idx = source_polygon[source];
+            if(res_polygon_idx && std::find(node_polygons.begin(), node_polygons.end(), res_polygon_idx) == node_polygons.end())
+                node_polygons.push_back(res_polygon_idx);
+        }
+        node.polygons = std::move(node_polygons);
+        res.m_nodes.push_back(std::move(node));
+    }
+
+    I removed = num_polygons - (I)res.m_polygons.size();
+    *this = std::move(res);
+    return removed;
+}
+
+
+namespace
+{
+    template<typename T, typename I>
+    struct HullFace
+    {
+        // Points of the triangle, and the face across each edge vertices[i] -> vertices[i + 1]
+        std::array<I, 3> vertices;
+        std::array<I, 3> neighbours;
+        PlaneT<T> plane;
+        std::vector<I> outside;
+        bool alive;
+    };
+
+    template<typename T, typename I>
+    PlaneT<T> hull_plane(std::span<const vec3<T>> points, I a, I b, I c)
+    {
+        vec3<T> n = vec3<T>::normalize(vec3<T>::cross(points[b] - points[a], points[c] - points[a]));
+        return {n, vec3<T>::dot(n, points[a])};
+    }
+
+    // Positive when q is in front of the triangle a, b, c. The sign comes from differences in
+    // double precision rather than the face's rounded plane, so two nearly coplanar neighbouring
+    // faces can't both claim a point that lies between them.
+    template<typename T, typename I>
+    double hull_orientation(std::span<const vec3<T>> points, I a, I b, I c, I q)
+    {
+        vec3<double> pa = points[a].template cast<double>();
+        vec3<double> ab = points[b].template cast<double>() - pa;
+        vec3<double> ac = points[c].template cast<double>() - pa;
+        return vec3<double>::dot(vec3<double>::cross(ab, ac), points[q].template cast<double>() - pa);
+    }
+
+    // Index of the edge of face that runs from a to b
+    template<typename T, typename I>
+    int hull_edge(const HullFace<T, I>& face, I a, I b)
+    {
+        for(int i = 0; i < 3; i++)
+        {
+            if(face.vertices[i] == a && face.vertices[(i + 1) % 3] == b)
+                return i;
+        }
+        return -1;
+    }
+
+    // Hands every point to the face it is furthest in front of, ignoring points within epsilon of
+    // all faces. The distance tests run on the hull's thread pool, split over the points in
+    // batches that are gathered once into separate x, y and z arrays, then run through the
+    // vectorised distances kernel for every new face; only the final bucketing
+    // into the faces' outside sets is serial. The pool outlives the steps, so even the small
+    // orphan sets of late steps are worth spreading once each thread gets a few thousand tests.
+    template<typename T, typename I>
+    void assign_outside_points(
+        ThreadPool& pool,
+        std::span<const vec3<T>> points,
+        std::span<const I> candidates,
+        std::vector<HullFace<T, I>>& faces,
+        std::span<const I> new_faces,
+        T epsilon
+    )
+    {
+        std::vector<I> assignment(candidates.size(), -1);
+        size_t min_per_thread = std::max<size_t>(32, 4096 / std::max<size_t>(1, new_faces.size()));
+        pool.parallel_for(candidates.size(), [&](size_t begin, size_t end) {
+            constexpr size_t batch_size = 64 * simd_width<T>;
+            std::array<T, batch_size> xs;
+            std::array<T, batch_size> ys;
+            std::array<T, batch_size> zs;
+            std::array<T, batch_size> distances;
+            std::array<T, batch_size> best;
+            // Face indices are kept at the width of T so the select below works in whole lanes,
+            // and only widened past it when I is wider
+            using FaceIndex = std::conditional_t<sizeof(T) == 8 || sizeof(I) == 8, int64_t, int32_t>;
+            std::array<FaceIndex, batch_size> best_face;
+            for(size_t batch = begin; batch < end; batch += batch_size)
+            {
+                size_t count = std::min(batch_size, end - batch);
+                for(size_t i = 0; i < count; i++)
+                {
+                    const vec3<T>& p = points[candidates[batch + i]];
+                    xs[i] = p.x;
+                    ys[i] = p.y;
+                    zs[i] = p.z;
+                    best[i] = epsilon;
+                    best_face[i] = -1;
+                }
+                for(I f : new_faces)
+                {
+                    faces[f].plane.distances(xs.data(), ys.data(), zs.data(), count, distances.data());
+                    // Select through a mask, as a branch on the comparison stops GCC vectorising
+                    for(size_t i = 0; i < count; i++)
+                    {
+                        T distance = distances[i];
+                        T old_best = best[i];
+                        FaceIndex further = -FaceIndex(distance > old_best);
+                        best[i] = distance > old_best ? distance : old_best;
+                        best_face[i] = (FaceIndex(f) & further) | (best_face[i] & ~further);
+                    }
+                }
+                for(size_t i = 0; i < count; i++)
+                    assignment[batch + i] = (I)best_face[i];
+            }
+        }, min_per_thread);
+
+        for(size_t i = 0; i < candidates.size(); i++)
+        {
+            if(assignment[i] != -1)
+                faces[assignment[i]].outside.push_back(candidates[i]);
+        }
+    }
+}
+
+template<typename T, typename I>
+std::shared_ptr<BSPT<T, I>> BSPT<T, I>::convex_hull(std::span<const Vec3> points)
+{
+    if(points.size() > (size_t)std::numeric_limits<I>::max())
+        throw std::invalid_argument("convex_hull has more points than the index type can address");
+    I num_points = (I)points.size();
+    if(num_points < 4)
+        throw std::invalid_argument("convex_hull needs at least 4 points");
+
+    // Extreme points along each axis, used both for the tolerance and the initial simplex
+    auto component = [](const Vec3& p, int axis) { return axis == 0 ? p.x : axis == 1 ? p.y : p.z; };
+    std::array<I, 6> extremes = {0, 0, 0, 0, 0, 0};
+    for(I i = 1; i < num_points; i++)
+    {
+        for(int axis = 0; axis < 3; axis++)
+        {
+            if(component(points[i], axis) < component(points[extremes[axis * 2]], axis))
+                extremes[axis * 2] = i;
+            if(component(points[i], axis) > component(points[extremes[axis * 2 + 1]], axis))
+                extremes[axis * 2 + 1] = i;
+        }
+    }
+
+    T scale = 0;
+    I i0 = 0;
+    I i1 = 0;
+    for(int a = 0; a < 6; a++)
+    {
+        for(int b = a + 1; b < 6; b++)
+        {
+            T len = Vec3::length(points[extremes[b]] - points[extremes[a]]);
+            if(len > scale)
+            {
+                scale = len;
+                i0 = extremes[a];
+                i1 = extremes[b];
+            }
+        }
+    }
+    T epsilon = geometry_epsilon<T> * scale;
+
+    // Furthest point from the line i0-i1, then from the plane through all three
+    I i2 = -1;
+    T best = epsilon;
+    Vec3 dir = Vec3::normalize(points[i1] - points[i0]);
+    for(I i = 0; i < num_points; i++)
+    {
+        T d = Vec3::length(Vec3::cross(points[i] - points[i0], dir));
+        if(d > best)
+        {
+            best = d;
+            i2 = i;
+        }
+    }
+    if(i2 == -1)
+        throw std::invalid_argument("convex_hull points are collinear");
+
+    I i3 = -1;
+    best = epsilon;
+    Plane base = hull_plane(points, i0, i1, i2);
+    for(I i = 0; i < num_points; i++)
+    {
+        T d = std::abs(base.distance(points[i]));
+        if(d > best)
+        {
+            best = d;
+            i3 = i;
+        }
+    }
+    if(i3 == -1)
+        throw std::invalid_argument("convex_hull points are coplanar");
+    if(base.distance(points[i3]) > 0)
+        std::swap(i1, i2);
+
+    // Initial tetrahedron, with the base facing away from i3
+    std::vector<HullFace<T, I>> faces;
+    std::array<std::array<I, 3>, 4> tetrahedron = {{{i0, i1, i2}, {i0, i3, i1}, {i1, i3, i2}, {i2, i3, i0}}};
+    for(const std::array<I, 3>& t : tetrahedron)
+        faces.push_back({t, {-1, -1, -1}, hull_plane(points, t[0], t[1], t[2]), {}, true});
+    for(I f = 0; f < 4; f++)
+    {
+        for(int i = 0; i < 3; i++)
+        {
+            I a = faces[f].vertices[i];
+            I b = faces[f].vertices[(i + 1) % 3];
+            for(I g = 0; g < 4; g++)
+            {
+                if(g != f && hull_edge(faces[g], b, a) != -1)
+                    faces[f].neighbours[i] = g;
+            }
+        }
+    }
+
+    std::vector<I> all_points(num_points);
+    for(I i = 0; i < num_points; i++)
+        all_points[i] = i;
+    std::array<I, 4> initial_faces = {0, 1, 2, 3};
+    ThreadPool pool;
+    assign_outside_points<T, I>(pool, points, all_points, faces, initial_faces, epsilon);
+
+    // Faces are only ever appended, and a face can only gain outside points when it is created,
+    // so a single pass over the growing face list expands the hull completely.
+    std::vector<I> visit_stamp;
+    std::vector<I> visible;
+    std::vector<I> stack;
+    std::vector<I> new_faces;
+    std::vector<I> orphans;
+    std::unordered_map<I, I> face_by_start;
+    std::unordered_map<I, I> face_by_end;
+    for(size_t f = 0; f < faces.size(); f++)
+    {
+        if(!faces[f].alive || faces[f].outside.empty())
+            continue;
+
+        I eye = faces[f].outside[0];
+        T eye_distance = faces[f].plane.distance(points[eye]);
+        for(I p : faces[f].outside)
+        {
+            T d = faces[f].plane.distance(points[p]);
+            if(d > eye_distance)
+            {
+                eye = p;
+                eye_distance = d;
+            }
+        }
+
+        // Flood fill the faces that can see the eye point. The test is the exact side of each
+        // face rather than a tolerance: a face the eye is nearly coplanar with that stays behind
+        // just gains a coplanar neighbour, which the merge below folds back in, whereas rounding
+        // the side the wrong way on one of two coplanar faces would fold the cone over the other.
+        visit_stamp.resize(faces.size(), -1);
+        visible.clear();
+        stack.assign(1, (I)f);
+        visit_stamp[f] = (I)f;
+        while(!stack.empty())
+        {
+            I g = stack.back();
+            stack.pop_back();
+            visible.push_back(g);
+            for(I h : faces[g].neighbours)
+            {
+                const std::array<I, 3>& v = faces[h].vertices;
+                if(visit_stamp[h] != (I)f && hull_orientation(points, v[0], v[1], v[2], eye) > 0)
+                {
+                    visit_stamp[h] = (I)f;
+                    stack.push_back(h);
+                }
+            }
+        }
+
+        // Replace the visible faces with a fan of triangles from each horizon edge to the eye
+        new_faces.clear();
+        face_by_start.clear();
+        face_by_end.clear();
+        for(I g : visible)
+        {
+            for(int i = 0; i < 3; i++)
+            {
+                I h = faces[g].neighbours[i];
+                if(visit_stamp[h] == (I)f)
+                    continue;
+
+                I a = faces[g].vertices[i];
+                I b = faces[g].vertices[(i + 1) % 3];
+                I new_face = (I)faces.size();
+                faces.push_back({{a, b, eye}, {h, -1, -1}, hull_plane(points, a, b, eye), {}, true});
+                faces[h].neighbours[hull_edge(faces[h], b, a)] = new_face;
+                new_faces.push_back(new_face);
+                face_by_start[a] = new_face;
+                face_by_end[b] = new_face;
+            }
+        }
+        for(I new_face : new_faces)
+        {
+            HullFace<T, I>& face = faces[new_face];
+            face.neighbours[1] = face_by_start.at(face.vertices[1]);
+            face.neighbours[2] = face_by_end.at(face.vertices[0]);
+        }
+
+        orphans.clear();
+        for(I g : visible)
+        {
+            faces[g].alive = false;
+            for(I p : faces[g].outside)
+            {
+                if(p != eye)
+                    orphans.push_back(p);
+            }
+            faces[g].outside = {};
+        }
+        assign_outside_points<T, I>(pool, points, orphans, faces, new_faces, epsilon);
+    }
+
+    // Merge coplanar triangles within the hull's own adjacency. Regions grow from the largest
+    // triangles first and only take neighbours whose corners all lie within epsilon of the seed's
+    // plane, so slightly tilted triangles can't chain into a bent face.
+    std::vector<I> alive_faces;
+    for(size_t f = 0; f < faces.size(); f++)
+    {
+        if(faces[f].alive)
+            alive_faces.push_back((I)f);
+    }
+    std::vector<T> areas(faces.size(), 0);
+    for(I f : alive_faces)
+    {
+        const std::array<I, 3>& v = faces[f].vertices;
+        areas[f] = Vec3::length(Vec3::cross(points[v[1]] - points[v[0]], points[v[2]] - points[v[0]]));
+    }
+    std::vector<I> seeds = alive_faces;
+    std::stable_sort(seeds.begin(), seeds.end(), [&](I a, I b) { return areas[a] > areas[b]; });
+
+    std::vector<I> region_of(faces.size(), -1);
+    std::vector<std::vector<I>> regions;
+    for(I seed : seeds)
+    {
+        if(region_of[seed] != -1)
+            continue;
+        I region = (I)regions.size();
+        const Plane& plane = faces[seed].plane;
+        regions.push_back({seed});
+        region_of[seed] = region;
+        stack.assign(1, seed);
+        while(!stack.empty())
+        {
+            I g = stack.back();
+            stack.pop_back();
+            for(I h : faces[g].neighbours)
+            {
+                if(region_of[h] != -1)
+                    continue;
+                bool coplanar = true;
+                for(I p : faces[h].vertices)
+                    coplanar = coplanar && std::abs(plane.distance(points[p])) <= epsilon;
+                if(coplanar)
+                {
+                    region_of[h] = region;
+                    regions[region].push_back(h);
+                    stack.push_back(h);
+                }
+            }
+        }
+    }
+
+    // Trace every region's outline as a loop of (face, edge) pairs. A region whose outline isn't a
+    // single simple loop keeps its triangles.
+    std::vector<std::vector<std::vector<std::array<I, 2>>>> region_loops(regions.size());
+    pool.parallel_for(regions.size(), [&](size_t begin, size_t end) {
+        for(size_t r = begin; r < end; r++)
+        {
+            const std::vector<I>& region = regions[r];
+            std::vector<std::array<I, 2>> loop;
+            if(region.size() > 1)
+            {
+                std::array<I, 2> start = {-1, -1};
+                I num_boundary_edges = 0;
+                for(I f : region)
+                {
+                    for(int i = 0; i < 3; i++)
+                    {
+                        if(region_of[faces[f].neighbours[i]] != (I)r)
+                        {
+                            num_boundary_edges++;
+                            if(start[0] == -1)
+                                start = {f, i};
+                        }
+                    }
+                }
+
+                std::array<I, 2> curr = start;
+                bool simple = true;
+                do
+                {
+                    loop.push_back(curr);
+                    if((I)loop.size() > num_boundary_edges)
+                    {
+                        simple = false;
+                        break;
+                    }
+
+                    // Rotate around the end vertex across interior edges to the next boundary edge
+                    I g = curr[0];
+                    int j = (curr[1] + 1) % 3;
+                    for(size_t steps = 0; region_of[faces[g].neighbours[j]] == (I)r; steps++)
+                    {
+                        if(steps > region.size() * 3)
+                        {
+                            simple = false;
+                            break;
+                        }
+                        I h = faces[g].neighbours[j];
+                        int k = hull_edge(faces[h], faces[g].vertices[(j + 1) % 3], faces[g].vertices[j]);
+                        g = h;
+                        j = (k + 1) % 3;
+                    }
+                    curr = {g, j};
+                } while(simple && curr != start);
+
+                if(simple && (I)loop.size() == num_boundary_edges)
+                {
+                    std::vector<I> loop_vertices;
+                    for(const std::array<I, 2>& edge : loop)
+                        loop_vertices.push_back(faces[edge[0]].vertices[edge[1]]);
+                    std::sort(loop_vertices.begin(), loop_vertices.end());
+                    simple = std::adjacent_find(loop_vertices.begin(), loop_vertices.end()) == loop_vertices.end();
+                }
+                else
+                    simple = false;
+
+                if(simple)
+                {
+                    region_loops[r].push_back(std::move(loop));
+                    continue;
+                }
+            }
+            for(I f : region)
+                region_loops[r].push_back({{f, 0}, {f, 1}, {f, 2}});
+        }
+    }, 64);
+
+    // A point in the middle of a straight hull edge is left as a corner of both loops along that
+    // edge. As in simplify(), it is dropped when it is collinear in every loop using it and only
+    // those two loops use it, as long as each loop keeps at least a triangle.
+    auto loop_point = [&](const std::array<I, 2>& edge) { return faces[edge[0]].vertices[edge[1]]; };
+    std::vector<I> usage(num_points, 0);
+    std::vector<I> collinear_usage(num_points, 0);
+    for(const std::vector<std::vector<std::array<I, 2>>>& loops : region_loops)
+    {
+        for(const std::vector<std::array<I, 2>>& loop : loops)
+        {
+            size_t n = loop.size();
+            for(size_t j = 0; j < n; j++)
+            {
+                I p = loop_point(loop[j]);
+                usage[p]++;
+                collinear_usage[p] += is_collinear(points[loop_point(loop[(j + n - 1) % n])], points[p], points[loop_point(loop[(j + 1) % n])]);
+            }
+        }
+    }
+    std::vector<char> removable(num_points);
+    for(I p = 0; p < num_points; p++)
+        removable[p] = usage[p] == 2 && collinear_usage[p] == 2;
+    for(const std::vector<std::vector<std::array<I, 2>>>& loops : region_loops)
+    {
+        for(const std::vector<std::array<I, 2>>& loop : loops)
+        {
+            size_t kept = 0;
+            for(const std::array<I, 2>& edge : loop)
+                kept += !removable[loop_point(edge)];
+            if(kept < 3)
+            {
+                for(const std::array<I, 2>& edge : loop)
+                    removable[loop_point(edge)] = 0;
+            }
+        }
+    }
+
+    // Emit the loops straight into the half edge arrays. Every emitted edge runs along one or more
+    // boundary edges of its region, and each of those is recorded against it. Its twin is then
+    // whichever edge covers the matching edge of the face across its first one, which the
+    // neighbouring region emits; no edge lookups are needed.
+    auto res = std::make_shared<BSPT>();
+    std::vector<EIdx> face_edges(faces.size() * 3);
+    std::vector<std::array<I, 2>> edge_sources;
+    std::vector<VIdx> vertex_remap(num_points);
+    for(const std::vector<std::vector<std::array<I, 2>>>& loops : region_loops)
+    {
+        for(const std::vector<std::array<I, 2>>& loop : loops)
+        {
+            size_t n = loop.size();
+            size_t start = 0;
+            while(removable[loop_point(loop[start])])
+                start++;
+            I num_edges = 0;
+            for(const std::array<I, 2>& edge : loop)
+                num_edges += !removable[loop_point(edge)];
+
+            PIdx polygon = (I)res->m_polygons.size();
+            EIdx first_edge = (I)res->m_half_edges.size();
+            res->m_polygons.push_back({.edge = first_edge, .debug_highlight = false});
+            I i = 0;
+            for(size_t j = 0; j < n; j++)
+            {
+                const std::array<I, 2>& edge = loop[(start + j) % n];
+                I p = loop_point(edge);
+                if(removable[p])
+                {
+                    face_edges[edge[0] * 3 + edge[1]] = first_edge.i + i - 1;
+                    continue;
+                }
+                if(!vertex_remap[p])
+                    vertex_remap[p] = res->create_vertex(points[p]);
+                EIdx this_edge = first_edge.i + i;
+                face_edges[edge[0] * 3 + edge[1]] = this_edge;
+                edge_sources.push_back(edge);
+                res->m_half_edges.push_back({
+                    .twin = EIdx::invalid(),
+                    .next = first_edge.i + (i + 1) % num_edges,
+                    .prev = first_edge.i + (i + num_edges - 1) % num_edges,
+                    .polygon = polygon,
+                    .vertex = vertex_remap[p],
+                    .debug_highlight = false});
+                if(!res->m_vertices[vertex_remap[p].i].edge)
+                    res->m_vertices.mut(vertex_remap[p].i).edge = this_edge;
+                i++;
+            }
+        }
+    }
+
+    for(I e = 0; e < (I)edge_sources.size(); e++)
+    {
+        const std::array<I, 2>& edge = edge_sources[e];
+        I a = faces[edge[0]].vertices[edge[1]];
+        I b = faces[edge[0]].vertices[(edge[1] + 1) % 3];
+        I g = faces[edge[0]].neighbours[edge[1]];
+        const HalfEdge& half_edge = res->m_half_edges[e];
+        res->m_half_edges.mut(e).twin = face_edges[g * 3 + hull_edge(faces[g], b, a)];
+        res->m_edge_map.insert({{half_edge.vertex, res->m_half_edges[half_edge.next.i].vertex}, EIdx(e)});
+    }
+
+    return res;
+}
+
+template class BSPT<float, int32_t>;
+template class BSPT<double, int32_t>;
+template class BSPT<double, int64_t>;
+template class MeshStreamT<float, int32_t>;
+template class MeshStreamT<double, int32_t>;
+template class MeshStreamT<double, int64_t>;
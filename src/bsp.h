@@ -2,74 +2,107 @@
 
 #include <vector>
 #include <memory>
+#include <array>
+#include <future>
 #include <span>
 #include <map>
-
-class float3
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+#include "chunked_vector.h"
+
+// Bytes in the widest vector register the compiler may target. Batched kernels take blocks of
+// separate x, y and z arrays sized in multiples of simd_width<T>, so their loops vectorise into
+// whole registers: twice as many lanes for float as for double.
+#if defined(__AVX512F__)
+constexpr size_t simd_bytes = 64;
+#elif defined(__AVX__)
+constexpr size_t simd_bytes = 32;
+#else
+constexpr size_t simd_bytes = 16;
+#endif
+
+template<typename T>
+constexpr size_t simd_width = simd_bytes / sizeof(T);
+
+// Relative tolerance for planarity, collinearity and hull tests, scaled to the precision of T
+template<typename T>
+constexpr T geometry_epsilon = std::is_same_v<T, float> ? T(1e-5) : T(1e-9);
+
+template<typename T>
+class vec3
 {
 public:
-    float x;
-    float y;
-    float z;
+    T x;
+    T y;
+    T z;
 
     // Dot product
-    static float dot(const float3& a, const float3& b)
+    static T dot(const vec3& a, const vec3& b)
     {
         return a.x * b.x + a.y * b.y + a.z * b.z;
     }
 
     // Cross product
-    static float3 cross(const float3& a, const float3& b)
+    static vec3 cross(const vec3& a, const vec3& b)
     {
-        return float3{
+        return vec3{
             a.y * b.z - a.z * b.y,
             a.z * b.x - a.x * b.z,
             a.x * b.y - a.y * b.x
         };
     }
 
-    static float length(const float3& a)
+    static T length(const vec3& a)
     {
-        return sqrtf(a.x * a.x + a.y * a.y + a.z * a.z);
+        return std::sqrt(a.x * a.x + a.y * a.y + a.z * a.z);
     }
 
-    static float3 normalize(const float3& a)
+    static vec3 normalize(const vec3& a)
     {
-        float len = sqrtf(a.x * a.x + a.y * a.y + a.z * a.z);
+        T len = std::sqrt(a.x * a.x + a.y * a.y + a.z * a.z);
         return {a.x / len, a.y / len, a.z / len};
     }
 
-    static bool similar(const float3& a, const float3& b)
+    static bool similar(const vec3& a, const vec3& b)
+    {
+        return std::abs(a.x - b.x) < 1e-6 && std::abs(a.y - b.y) < 1e-6 && std::abs(a.z - b.z) < 1e-6;
+    }
+
+    // Conversion to another scalar type
+    template<typename U>
+    vec3<U> cast() const
     {
-        return fabs(a.x - b.x) < 1e-6 && fabs(a.y - b.y) < 1e-6 && fabs(a.z - b.z) < 1e-6;
+        return vec3<U>{(U)x, (U)y, (U)z};
     }
 
     // Addition
-    float3 operator+(const float3& other) const
+    vec3 operator+(const vec3& other) const
     {
-        return float3{x + other.x, y + other.y, z + other.z};
+        return vec3{x + other.x, y + other.y, z + other.z};
     }
 
     // Subtraction
-    float3 operator-(const float3& other) const
+    vec3 operator-(const vec3& other) const
     {
-        return float3{x - other.x, y - other.y, z - other.z};
+        return vec3{x - other.x, y - other.y, z - other.z};
     }
 
     // Multiplication by scalar
-    float3 operator*(float scalar) const
+    vec3 operator*(T scalar) const
     {
-        return float3{x * scalar, y * scalar, z * scalar};
+        return vec3{x * scalar, y * scalar, z * scalar};
     }
 
     // Division by scalar
-    float3 operator/(float scalar) const
+    vec3 operator/(T scalar) const
     {
-        return float3{x / scalar, y / scalar, z / scalar};
+        return vec3{x / scalar, y / scalar, z / scalar};
     }
 
     // Compound assignment operators
-    float3& operator+=(const float3& other)
+    vec3& operator+=(const vec3& other)
     {
         x += other.x;
         y += other.y;
@@ -77,7 +110,7 @@ public:
         return *this;
     }
 
-    float3& operator-=(const float3& other)
+    vec3& operator-=(const vec3& other)
     {
         x -= other.x;
         y -= other.y;
@@ -85,7 +118,7 @@ public:
         return *this;
     }
 
-    float3& operator*=(float scalar)
+    vec3& operator*=(T scalar)
     {
         x *= scalar;
         y *= scalar;
@@ -93,7 +126,7 @@ public:
         return *this;
     }
 
-    float3& operator/=(float scalar)
+    vec3& operator/=(T scalar)
     {
         x /= scalar;
         y /= scalar;
@@ -102,23 +135,41 @@ public:
     }
 };
 
-class Plane
+using float3 = vec3<float>;
+using double3 = vec3<double>;
+
+template<typename T>
+class PlaneT
 {
 public:
-    float3 normal;
-    float d;
+    vec3<T> normal;
+    T d;
+
+    T distance(vec3<T> point) const { return vec3<T>::dot(normal, point) - d; }
 
-    float distance(float3 point) const { return float3::dot(normal, point) - d; }
+    // Signed distances of count points given as separate coordinate arrays, written to out
+    void distances(const T* xs, const T* ys, const T* zs, size_t count, T* out) const
+    {
+        T nx = normal.x;
+        T ny = normal.y;
+        T nz = normal.z;
+        for(size_t i = 0; i < count; i++)
+            out[i] = nx * xs[i] + ny * ys[i] + nz * zs[i] - d;
+    }
 };
 
-struct VIdx
+using Plane = PlaneT<float>;
+using Planed = PlaneT<double>;
+
+template<typename I>
+struct VIdxT
 {
-    int i;
+    I i;
 
-    VIdx() : i(-1) {}
-    VIdx(int _i) : i(_i) {}
+    VIdxT() : i(-1) {}
+    VIdxT(I _i) : i(_i) {}
 
-    bool operator==(const VIdx& other) const
+    bool operator==(const VIdxT& other) const
     {
         return i == other.i;
     }
@@ -128,24 +179,25 @@ struct VIdx
         return i != -1;
     }
 
-    static VIdx invalid()
+    static VIdxT invalid()
     {
         return { -1 };
     }
 
-    bool operator<(const VIdx& other) const {
+    bool operator<(const VIdxT& other) const {
         return i < other.i;
     }
 };
 
-struct EIdx
+template<typename I>
+struct EIdxT
 {
-    int i;
+    I i;
 
-    EIdx() : i(-1) {}
-    EIdx(int _i) : i(_i) {}
+    EIdxT() : i(-1) {}
+    EIdxT(I _i) : i(_i) {}
 
-    bool operator==(const EIdx& other) const
+    bool operator==(const EIdxT& other) const
     {
         return i == other.i;
     }
@@ -155,24 +207,25 @@ struct EIdx
         return i != -1;
     }
 
-    static EIdx invalid()
+    static EIdxT invalid()
     {
         return { -1 };
     }
 
-    bool operator<(const EIdx& other) const {
+    bool operator<(const EIdxT& other) const {
         return i < other.i;
     }
 };
 
-struct PIdx
+template<typename I>
+struct PIdxT
 {
-    int i;
+    I i;
 
-    PIdx() : i(-1) {}
-    PIdx(int _i) : i(_i) {}
+    PIdxT() : i(-1) {}
+    PIdxT(I _i) : i(_i) {}
 
-    bool operator==(const PIdx& other) const
+    bool operator==(const PIdxT& other) const
     {
         return i == other.i;
     }
@@ -182,60 +235,81 @@ struct PIdx
         return i != -1;
     }
 
-    static PIdx invalid()
+    static PIdxT invalid()
     {
         return { -1 };
     }
 
-    bool operator<(const PIdx& other) const {
+    bool operator<(const PIdxT& other) const {
         return i < other.i;
     }
 };
 
-class Vertex
+using VIdx = VIdxT<int32_t>;
+using EIdx = EIdxT<int32_t>;
+using PIdx = PIdxT<int32_t>;
+
+template<typename T, typename I>
+class VertexT
 {
 public:
-    EIdx edge;
-    float3 position;
+    EIdxT<I> edge;
+    vec3<T> position;
 };
 
-class HalfEdge
+template<typename I>
+class HalfEdgeT
 {
 public:
-    EIdx twin;
-    EIdx next;
-    EIdx prev;
-    PIdx polygon;
-    VIdx vertex;
+    EIdxT<I> twin;
+    EIdxT<I> next;
+    EIdxT<I> prev;
+    PIdxT<I> polygon;
+    VIdxT<I> vertex;
     bool debug_highlight;
 };
 
-struct EdgeId
+template<typename I>
+struct EdgeIdT
 {
-    VIdx v0;
-    VIdx v1;
+    VIdxT<I> v0;
+    VIdxT<I> v1;
 
-    bool operator<(const EdgeId& other) const {
+    bool operator<(const EdgeIdT& other) const {
         if(v0 < other.v0) return true;
         if(other.v0 < v0) return false;
         return v1 < other.v1;
     }
 
-    bool operator==(const EdgeId& other) const {
+    bool operator==(const EdgeIdT& other) const {
         return v0 == other.v0 && v1 == other.v1;
     }
 };
 
-class Polygon
+template<typename I>
+struct EdgeIdHashT
+{
+    size_t operator()(const EdgeIdT<I>& id) const
+    {
+        return (size_t)id.v0.i * 73856093u ^ (size_t)id.v1.i * 19349663u;
+    }
+};
+
+template<typename I>
+class PolygonT
 {
 public:
-    EIdx edge;
+    EIdxT<I> edge;
     bool debug_highlight;
 
-    int split_id_0;
-    int split_id_1;
+    I split_id_0;
+    I split_id_1;
 };
 
+using HalfEdge = HalfEdgeT<int32_t>;
+using Polygon = PolygonT<int32_t>;
+
+// Render data is always single precision, whatever the precision of the BSP it came from
 class Mesh
 {
 public:
@@ -246,22 +320,47 @@ public:
 
 };
 
-class Node
+template<typename T, typename I>
+class NodeT
 {
 public:
-    Plane plane;
-    std::vector<PIdx> polygons;
-    int front;
-    int back;
+    PlaneT<T> plane;
+    std::vector<PIdxT<I>> polygons;
+    I front;
+    I back;
 };
 
-class BSP
+template<typename T, typename I>
+class MeshStreamT;
+
+// Half edge BSP over scalar type T, with I as the integer type of all element indices. Both are
+// fixed at compile time so the inner loops never dispatch on them; BSP and BSPd below cover
+// the common cases, and BSPd64's 64-bit I lifts the 2^31 element limit for huge models. All
+// three are bound in Python under those names.
+template<typename T, typename I = int32_t>
+class BSPT
 {
 public:
-
-    static std::shared_ptr<BSP> cube(float3 size, bool center = false);
-
-    VIdx create_vertex(float3 position);
+    using Scalar = T;
+    using Index = I;
+    using Vec3 = vec3<T>;
+    using Plane = PlaneT<T>;
+    using VIdx = VIdxT<I>;
+    using EIdx = EIdxT<I>;
+    using PIdx = PIdxT<I>;
+    using Vertex = VertexT<T, I>;
+    using HalfEdge = HalfEdgeT<I>;
+    using Polygon = PolygonT<I>;
+    using Node = NodeT<T, I>;
+    using EdgeId = EdgeIdT<I>;
+
+    static std::shared_ptr<BSPT> cube(Vec3 size, bool center = false);
+
+    // Convex hull of a point cloud, built with a quickhull that spreads the point partitioning
+    // across threads. Coplanar hull triangles are merged into single polygons.
+    static std::shared_ptr<BSPT> convex_hull(std::span<const Vec3> points);
+
+    VIdx create_vertex(Vec3 position);
 
     PIdx create_polygon(std::span<const VIdx> indices);
 
@@ -271,20 +370,56 @@ public:
         return create_polygon(indices_span);
     }
 
+    // Deletes a polygon along with its half edges and their edge map entries. The slots are left
+    // as tombstones (an invalid polygon edge, or an invalid half edge polygon) and go on free lists
+    // that create_polygon draws from, so every other index stays valid. Twins of the deleted
+    // edges become open boundary edges.
+    void delete_polygon(PIdx polygon_idx);
+
+    bool is_deleted(PIdx idx) const
+    {
+        return !m_polygons[idx.i].edge;
+    }
+
+    bool is_deleted(EIdx idx) const
+    {
+        return !m_half_edges[idx.i].polygon;
+    }
+
+    // Removes all tombstones, renumbering the remaining elements in parallel. Polygons keep their
+    // order, half edges are laid out loop by loop in polygon order and vertices in the order the
+    // loops reach them, so walking the mesh touches memory in sequence. Vertices that no half edge
+    // uses are dropped. Invalidates every index held outside the BSP.
+    void compact();
+
     std::shared_ptr<Mesh> to_tri_mesh() const;
     std::shared_ptr<Mesh> to_edge_mesh() const;
 
-    const std::vector<Vertex>& vertices() const
+    // Appends the triangles of polygons [first_polygon, end_polygon) to mesh.
+    void append_tri_mesh(Mesh& mesh, I first_polygon, I end_polygon) const;
+
+    // Streams the triangle mesh of a snapshot of this BSP in chunks of polygons_per_chunk
+    // polygons, so only a couple of chunks are ever held in memory at once.
+    std::shared_ptr<MeshStreamT<T, I>> to_tri_mesh_chunks(size_t polygons_per_chunk) const;
+
+    // Returns a copy of this BSP in O(1). The copy shares all of its storage with this one
+    // and each side only duplicates the chunks it modifies afterwards.
+    std::shared_ptr<BSPT> snapshot() const
+    {
+        return std::make_shared<BSPT>(*this);
+    }
+
+    const ChunkedVector<Vertex>& vertices() const
     {
         return m_vertices;
     }
 
-    const std::vector<HalfEdge>& half_edges() const
+    const ChunkedVector<HalfEdge>& half_edges() const
     {
         return m_half_edges;
     }
 
-    const std::vector<Polygon>& polygons() const
+    const ChunkedVector<Polygon>& polygons() const
     {
         return m_polygons;
     }
@@ -295,7 +430,7 @@ public:
     }
     HalfEdge& get_edge(EIdx idx)
     {
-        return m_half_edges[idx.i];
+        return m_half_edges.mut(idx.i);
     }
 
     const Vertex& get_vertex(VIdx idx) const
@@ -304,7 +439,7 @@ public:
     }
     Vertex& get_vertex(VIdx idx)
     {
-        return m_vertices[idx.i];
+        return m_vertices.mut(idx.i);
     }
 
     const Polygon& get_polygon(PIdx idx) const
@@ -313,15 +448,21 @@ public:
     }
     Polygon& get_polygon(PIdx idx)
     {
-        return m_polygons[idx.i];
+        return m_polygons.mut(idx.i);
     }
 
+    // Merges adjacent coplanar polygons with matching attributes into single faces, removes
+    // collinear vertices and sliver polygons, then compacts the arrays. Returns the number of
+    // polygons removed.
+    I simplify();
+
     void split_by_plane(const Plane& plane)
     {
         std::vector<PIdx> polygons;
-        for(int i = 0; i < m_polygons.size(); i++)
+        for(I i = 0; i < (I)m_polygons.size(); i++)
         {
-            polygons.push_back({i});
+            if(!is_deleted(PIdx(i)))
+                polygons.push_back({i});
         }
         std::vector<PIdx> coplanar;
         std::vector<PIdx> front;
@@ -332,9 +473,10 @@ public:
     void split(const Plane& plane, std::vector<PIdx>& coplanar, std::vector<PIdx>& front, std::vector<PIdx>& back)
     {
         std::vector<PIdx> polygons;
-        for(int i = 0; i < m_polygons.size(); i++)
+        for(I i = 0; i < (I)m_polygons.size(); i++)
         {
-            polygons.push_back({i});
+            if(!is_deleted(PIdx(i)))
+                polygons.push_back({i});
         }
         split(polygons, plane, coplanar, front, back);
     }
@@ -342,15 +484,75 @@ public:
     void split(std::vector<PIdx> polygons, const Plane& plane, std::vector<PIdx>& coplanar, std::vector<PIdx>& front, std::vector<PIdx>& back);
 
 private:
-    std::vector<Vertex> m_vertices;
-    std::vector<HalfEdge> m_half_edges;
-    std::vector<Polygon> m_polygons;
-    std::vector<Node> m_nodes;
-    std::map<EdgeId, EIdx> m_edge_map;
+    EIdx allocate_half_edge();
+    PIdx allocate_polygon();
+
+    ChunkedVector<Vertex> m_vertices;
+    ChunkedVector<HalfEdge> m_half_edges;
+    ChunkedVector<Polygon> m_polygons;
+    ChunkedVector<Node> m_nodes;
+    ChunkedMap<EdgeId, EIdx, EdgeIdHashT<I>> m_edge_map;
+    ChunkedVector<EIdx> m_free_half_edges;
+    ChunkedVector<PIdx> m_free_polygons;
 };
 
-class Context
+// Reads the triangle mesh of a BSP as a sequence of chunks, each covering the next contiguous
+// range of polygons with its own local indices. The stream holds a snapshot, so the source BSP
+// may be edited while it is read.
+//
+// Chunks are built into a pair of rotating buffers: while the caller reads one, a worker thread
+// fills the other with the chunk after it. A buffer is refilled in place only once the caller
+// has dropped every reference to the chunk it held; otherwise a new buffer replaces it, so a
+// chunk never changes under its reader.
+template<typename T, typename I>
+class MeshStreamT
 {
+public:
+    MeshStreamT(std::shared_ptr<const BSPT<T, I>> bsp, size_t polygons_per_chunk);
+    ~MeshStreamT();
+
+    MeshStreamT(const MeshStreamT&) = delete;
+    MeshStreamT& operator=(const MeshStreamT&) = delete;
+
+    size_t chunk_count() const
+    {
+        return m_chunk_count;
+    }
+
+    // Waits for the next chunk and starts building the one after it. Returns null once every
+    // polygon has been streamed.
+    std::shared_ptr<Mesh> next();
 
+private:
+    void start(size_t chunk);
+
+    std::shared_ptr<const BSPT<T, I>> m_bsp;
+    size_t m_polygons_per_chunk;
+    size_t m_chunk_count;
+    size_t m_next_chunk = 0;
+    std::array<std::shared_ptr<Mesh>, 2> m_buffers;
+    std::future<void> m_pending;
 };
 
+using Vertex = VertexT<float, int32_t>;
+using Vertexd = VertexT<double, int32_t>;
+using Node = NodeT<float, int32_t>;
+using Noded = NodeT<double, int32_t>;
+using BSP = BSPT<float>;
+using BSPd = BSPT<double>;
+using BSPd64 = BSPT<double, int64_t>;
+using MeshStream = MeshStreamT<float, int32_t>;
+using MeshStreamd = MeshStreamT<double, int32_t>;
+using MeshStreamd64 = MeshStreamT<double, int64_t>;
+
+extern template class BSPT<float, int32_t>;
+extern template class BSPT<double, int32_t>;
+extern template class BSPT<double, int64_t>;
+extern template class MeshStreamT<float, int32_t>;
+extern template class MeshStreamT<double, int32_t>;
+extern template class MeshStreamT<double, int64_t>;
+
+class Context
+{
+
+};
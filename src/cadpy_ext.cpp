@@ -2,7 +2,7 @@
 #include <nanobind/stl/shared_ptr.h>
 #include <nanobind/nanobind.h>
 #include <nanobind/ndarray.h>
-#include <nanobind/stl/bind_vector.h>
+#include <nanobind/make_iterator.h>
 #include <nanobind/stl/string.h>
 
 #include <fmt/format.h>
@@ -16,68 +16,115 @@ namespace nb = nanobind;
 
 using namespace nb::literals;
 
-using VertexVector = std::vector<Vertex>;
-using HalfEdgeVector = std::vector<HalfEdge>;
-using PolygonVector = std::vector<Polygon>;
-
-NB_MODULE(cadpy_ext, m) {
-    m.doc() = "This is a \"hello world\" example with nanobind";
+// Read-only sequence view of one of the BSP's element arrays. Elements are returned by value,
+// so nothing Python holds points into chunks that a later edit may replace.
+template<typename T>
+void bind_chunked_vector(nb::module_& m, const char* name)
+{
+    using Vector = ChunkedVector<T>;
+
+    nb::class_<Vector>(m, name)
+        .def("__len__", &Vector::size)
+        .def("__getitem__", [](const Vector& self, int64_t index) {
+            if (index < 0)
+                index += (int64_t)self.size();
+            if (index < 0 || index >= (int64_t)self.size())
+                throw nb::index_error();
+            return self[index];
+        }, "index"_a)
+        .def("__iter__", [](const Vector& self) {
+            return nb::make_iterator<nb::rv_policy::copy>(nb::type<Vector>(), "iterator", self.begin(), self.end());
+        }, nb::keep_alive<0, 1>());
+}
 
-    nb::class_<float3>(m,"float3")
+// Python names of the classes that depend on the scalar type only
+struct ScalarNames
+{
+    const char* vec3;
+    const char* plane;
+};
+
+// Python names of the classes that depend on the index type only
+struct IndexNames
+{
+    const char* vidx;
+    const char* eidx;
+    const char* pidx;
+    const char* half_edge;
+    const char* half_edge_vector;
+    const char* polygon;
+    const char* polygon_vector;
+};
+
+// Python names of the classes that depend on both
+struct BSPNames
+{
+    const char* vertex;
+    const char* vertex_vector;
+    const char* node;
+    const char* bsp;
+    const char* mesh_stream;
+};
+
+template<typename T>
+void bind_scalar_types(nb::module_& m, const ScalarNames& names)
+{
+    using Vec3 = vec3<T>;
+    using Plane = PlaneT<T>;
+
+    nb::class_<Vec3>(m, names.vec3)
         .def(nb::init())
-        .def("__init__", [](float3 *self, float x, float y, float z) {
-            new (self) float3{x, y, z};
+        .def("__init__", [](Vec3 *self, T x, T y, T z) {
+            new (self) Vec3{x, y, z};
         }, "x"_a, "y"_a, "z"_a)
-        .def_rw("x", &float3::x)
-        .def_rw("y", &float3::y)
-        .def_rw("z", &float3::z)
-        .def("dot", &float3::dot)
-        .def("cross", &float3::cross)
-        .def("length", &float3::length)
-        .def("normalize", &float3::normalize)
-        .def("similar", &float3::similar)
-        .def("__add__", [](const float3 &a, const float3 &b) { return a + b; })
-        .def("__sub__", [](const float3 &a, const float3 &b) { return a - b; })
-        .def("__mul__", [](const float3 &a, float b) { return a * b; })
-        .def("__truediv__", [](const float3 &a, float b) { return a / b; })
-        .def("__iadd__", [](float3 &a, const float3 &b) { a += b; return a; })
-        .def("__isub__", [](float3 &a, const float3 &b) { a -= b; return a; })
-        .def("__imul__", [](float3 &a, float b) { a *= b; return a; })
-        .def("__itruediv__", [](float3 &a, float b) { a /= b; return a; });
-
-    nb::class_<Plane>(m,"Plane").def(nb::init())
+        .def_rw("x", &Vec3::x)
+        .def_rw("y", &Vec3::y)
+        .def_rw("z", &Vec3::z)
+        .def("dot", &Vec3::dot)
+        .def("cross", &Vec3::cross)
+        .def("length", &Vec3::length)
+        .def("normalize", &Vec3::normalize)
+        .def("similar", &Vec3::similar)
+        .def("__add__", [](const Vec3 &a, const Vec3 &b) { return a + b; })
+        .def("__sub__", [](const Vec3 &a, const Vec3 &b) { return a - b; })
+        .def("__mul__", [](const Vec3 &a, T b) { return a * b; })
+        .def("__truediv__", [](const Vec3 &a, T b) { return a / b; })
+        .def("__iadd__", [](Vec3 &a, const Vec3 &b) { a += b; return a; })
+        .def("__isub__", [](Vec3 &a, const Vec3 &b) { a -= b; return a; })
+        .def("__imul__", [](Vec3 &a, T b) { a *= b; return a; })
+        .def("__itruediv__", [](Vec3 &a, T b) { a /= b; return a; });
+
+    nb::class_<Plane>(m, names.plane).def(nb::init())
         .def_rw("normal", &Plane::normal)
         .def_rw("d", &Plane::d);
+}
 
-    nb::class_<VIdx>(m,"VIdx");
-    nb::class_<EIdx>(m,"EIdx");
-    nb::class_<PIdx>(m,"PIdx");
+template<typename I>
+void bind_index_types(nb::module_& m, const IndexNames& names)
+{
+    using VIdx = VIdxT<I>;
+    using EIdx = EIdxT<I>;
+    using PIdx = PIdxT<I>;
+    using HalfEdge = HalfEdgeT<I>;
+    using Polygon = PolygonT<I>;
 
-    nb::bind_vector<VertexVector>(m, "VertexVector");
-    nb::bind_vector<HalfEdgeVector>(m, "HalfEdgeVector");
-    nb::bind_vector<PolygonVector>(m, "PolygonVector");
+    nb::class_<VIdx>(m, names.vidx).def_ro("i", &VIdx::i);
+    nb::class_<EIdx>(m, names.eidx).def_ro("i", &EIdx::i);
+    nb::class_<PIdx>(m, names.pidx).def_ro("i", &PIdx::i);
 
-    nb::class_<Vertex>(m,"Vertex")
-        .def_ro("edge", &Vertex::edge)
-        .def_ro("position", &Vertex::position)
-        .def("__repr__", [](const Vertex &v) {
+    bind_chunked_vector<HalfEdge>(m, names.half_edge_vector);
+    bind_chunked_vector<Polygon>(m, names.polygon_vector);
 
-            return fmt::format("Vertex(e={}, p=[{}, {}, {}])",
-                v.edge.i,
-                v.position.x,
-                v.position.y,
-                v.position.z);
-        });
-
-    nb::class_<HalfEdge>(m,"HalfEdge")
+    nb::class_<HalfEdge>(m, names.half_edge)
         .def_ro("twin", &HalfEdge::twin)
         .def_ro("next", &HalfEdge::next)
         .def_ro("prev", &HalfEdge::prev)
         .def_ro("polygon", &HalfEdge::polygon)
         .def_ro("vertex", &HalfEdge::vertex)
-        .def("__repr__", [](const HalfEdge &e) {
+        .def("__repr__", [name = names.half_edge](const HalfEdge &e) {
 
-            return fmt::format("HalfEdge(et={}, en={}, ep={}, p={}, v={})",
+            return fmt::format("{}(et={}, en={}, ep={}, p={}, v={})",
+                name,
                 e.twin.i,
                 e.next.i,
                 e.prev.i,
@@ -85,12 +132,91 @@ NB_MODULE(cadpy_ext, m) {
                 e.vertex.i);
         });
 
-    nb::class_<Polygon>(m,"Polygon")
+    nb::class_<Polygon>(m, names.polygon)
         .def_ro("edge", &Polygon::edge)
-        .def("__repr__", [](const Polygon &p) {
+        .def("__repr__", [name = names.polygon](const Polygon &p) {
 
-            return fmt::format("Polygon(e={})", p.edge.i);
+            return fmt::format("{}(e={})", name, p.edge.i);
         });
+}
+
+template<typename T, typename I>
+void bind_bsp_types(nb::module_& m, const BSPNames& names)
+{
+    using Vec3 = vec3<T>;
+    using BSP = BSPT<T, I>;
+    using Vertex = typename BSP::Vertex;
+    using Node = typename BSP::Node;
+    using VIdx = typename BSP::VIdx;
+    using MeshStream = MeshStreamT<T, I>;
+
+    bind_chunked_vector<Vertex>(m, names.vertex_vector);
+
+    nb::class_<Vertex>(m, names.vertex)
+        .def_ro("edge", &Vertex::edge)
+        .def_ro("position", &Vertex::position)
+        .def("__repr__", [name = names.vertex](const Vertex &v) {
+
+            return fmt::format("{}(e={}, p=[{}, {}, {}])",
+                name,
+                v.edge.i,
+                v.position.x,
+                v.position.y,
+                v.position.z);
+        });
+
+    nb::class_<Node>(m, names.node)
+        .def_ro("plane", &Node::plane)
+        .def_ro("polygons", &Node::polygons)
+        .def_ro("front", &Node::front)
+        .def_ro("back", &Node::back);
+
+    nb::class_<BSP>(m, names.bsp)
+        .def(nb::init())
+        .def_static("cube", &BSP::cube, "size"_a, "center"_a=false)
+        .def_static("convex_hull", [](nb::ndarray<T, nb::ndim<2>, nb::c_contig, nb::device::cpu> points) {
+            if (points.shape(1) != 3)
+                throw std::invalid_argument("points must have shape (N, 3)");
+            std::span<const Vec3> positions((const Vec3*)points.data(), points.shape(0));
+            nb::gil_scoped_release release;
+            return BSP::convex_hull(positions);
+        }, "points"_a)
+        .def("create_vertex", &BSP::create_vertex, "position"_a)
+        .def("create_polygon", [](BSP* self, nb::iterable indices) {
+            std::vector<VIdx> vertex_indices;
+            for (nb::handle h : indices)
+                vertex_indices.push_back(nb::cast<VIdx>(h));
+            return self->create_polygon(std::span<const VIdx>(vertex_indices));
+        }, "indices"_a)
+        .def("delete_polygon", &BSP::delete_polygon, "polygon"_a)
+        .def("compact", &BSP::compact)
+        .def("snapshot", &BSP::snapshot)
+        .def("simplify", &BSP::simplify)
+        .def_prop_ro("vertices", &BSP::vertices, nb::rv_policy::reference_internal)
+        .def_prop_ro("half_edges", &BSP::half_edges, nb::rv_policy::reference_internal)
+        .def_prop_ro("polygons", &BSP::polygons, nb::rv_policy::reference_internal)
+        .def("split", &BSP::split_by_plane, "plane"_a)
+        .def("to_tri_mesh", &BSP::to_tri_mesh)
+        .def("to_tri_mesh_chunks", &BSP::to_tri_mesh_chunks, "polygons_per_chunk"_a=65536)
+        .def("to_edge_mesh", &BSP::to_edge_mesh);
+
+    nb::class_<MeshStream>(m, names.mesh_stream)
+        .def("__len__", &MeshStream::chunk_count)
+        .def("__iter__", [](nb::handle self) { return self; })
+        .def("__next__", [](MeshStream* self) {
+            std::shared_ptr<Mesh> chunk;
+            {
+                nb::gil_scoped_release release;
+                chunk = self->next();
+            }
+            if (!chunk)
+                throw nb::stop_iteration();
+            return chunk;
+        });
+}
+
+NB_MODULE(cadpy_ext, m) {
+    m.doc() = "This is a \"hello world\" example with nanobind";
 
     nb::class_<Mesh>(m,"Mesh")
         .def_prop_ro("positions", [](Mesh* self){
@@ -110,20 +236,13 @@ NB_MODULE(cadpy_ext, m) {
             return nb::ndarray<int, nb::numpy>(self->indices.data(), {self->indices.size()});
         }, nb::rv_policy::reference_internal);
 
-    nb::class_<Node>(m,"Node")
-        .def_ro("plane", &Node::plane)
-        .def_ro("polygons", &Node::polygons)
-        .def_ro("front", &Node::front)
-        .def_ro("back", &Node::back);
-
-    nb::class_<BSP>(m,"BSP")
-        .def_static("cube", &BSP::cube, "size"_a, "center"_a=false)
-        .def_prop_ro("vertices", &BSP::vertices, nb::rv_policy::reference_internal)
-        .def_prop_ro("half_edges", &BSP::half_edges, nb::rv_policy::reference_internal)
-        .def_prop_ro("polygons", &BSP::polygons, nb::rv_policy::reference_internal)
-        .def("split", &BSP::split_by_plane, "plane"_a)
-        .def("to_tri_mesh", &BSP::to_tri_mesh)
-        .def("to_edge_mesh", &BSP::to_edge_mesh);
+    bind_scalar_types<float>(m, {"float3", "Plane"});
+    bind_scalar_types<double>(m, {"double3", "Planed"});
+    bind_index_types<int32_t>(m, {"VIdx", "EIdx", "PIdx", "HalfEdge", "HalfEdgeVector", "Polygon", "PolygonVector"});
+    bind_index_types<int64_t>(m, {"VIdx64", "EIdx64", "PIdx64", "HalfEdge64", "HalfEdge64Vector", "Polygon64", "Polygon64Vector"});
+    bind_bsp_types<float, int32_t>(m, {"Vertex", "VertexVector", "Node", "BSP", "MeshStream"});
+    bind_bsp_types<double, int32_t>(m, {"Vertexd", "VertexdVector", "Noded", "BSPd", "MeshStreamd"});
+    bind_bsp_types<double, int64_t>(m, {"Vertexd64", "Vertexd64Vector", "Noded64", "BSPd64", "MeshStreamd64"});
 
     m.def("add", [](int a, int b) {
         return a + b;
@@ -0,0 +1,369 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+// Vector-like container that stores its elements in fixed size chunks held by shared pointers.
+// The chunks are reached through a two-level table: a directory of tables, each holding
+// table_size chunk pointers, with the directory and every table also held by shared pointers.
+// Copying a ChunkedVector is O(1): the copy shares the directory, the tables and every chunk
+// with the original. Reads never copy anything. Writes go through mut(), which clones only the
+// directory, the table and the chunk on the path to the element, and only while they are still
+// shared, so the first write after a copy costs a few hundred pointers rather than one per chunk
+// and the memory held by a copy grows with the edits made afterwards.
+//
+// References returned by mut() stay valid until the container is copied: after a copy, writing
+// through an old reference would also modify the copy.
+template<typename T, int ChunkBits = 10, int TableBits = 8>
+class ChunkedVector
+{
+public:
+    static constexpr size_t chunk_size = size_t(1) << ChunkBits;
+    static constexpr size_t chunk_mask = chunk_size - 1;
+    static constexpr size_t table_size = size_t(1) << TableBits;
+    static constexpr size_t table_mask = table_size - 1;
+
+    using Chunk = std::array<T, chunk_size>;
+    using Table = std::array<std::shared_ptr<Chunk>, table_size>;
+    using Directory = std::vector<std::shared_ptr<Table>>;
+
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        const_iterator() = default;
+        const_iterator(const ChunkedVector* owner, size_t index)
+            : m_owner(owner)
+            , m_index(index)
+        {
+        }
+
+        const T& operator*() const { return (*m_owner)[m_index]; }
+        const T* operator->() const { return &(*m_owner)[m_index]; }
+
+        const_iterator& operator++()
+        {
+            m_index++;
+            return *this;
+        }
+        const_iterator operator++(int)
+        {
+            const_iterator res = *this;
+            m_index++;
+            return res;
+        }
+
+        bool operator==(const const_iterator& other) const { return m_index == other.m_index; }
+        bool operator!=(const const_iterator& other) const { return m_index != other.m_index; }
+
+    private:
+        const ChunkedVector* m_owner = nullptr;
+        size_t m_index = 0;
+    };
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    const T& operator[](size_t index) const
+    {
+        const Table& table = *(*m_directory)[index >> (ChunkBits + TableBits)];
+        return (*table[(index >> ChunkBits) & table_mask])[index & chunk_mask];
+    }
+
+    // Mutable access to an element, unsharing the table and chunk holding it first if needed.
+    T& mut(size_t index)
+    {
+        Table& table = unique(unique_directory()[index >> (ChunkBits + TableBits)]);
+        return unique(table[(index >> ChunkBits) & table_mask])[index & chunk_mask];
+    }
+
+    void push_back(const T& value)
+    {
+        if ((m_size & chunk_mask) == 0)
+            add_chunk(m_size >> ChunkBits);
+        mut(m_size) = value;
+        m_size++;
+    }
+
+    // Grows with default constructed elements or drops the elements past new_size.
+    void resize(size_t new_size)
+    {
+        if (new_size < m_size) {
+            size_t num_chunks = (new_size + chunk_mask) >> ChunkBits;
+            Directory& directory = unique_directory();
+            directory.resize((num_chunks + table_mask) >> TableBits);
+            if (num_chunks & table_mask) {
+                Table& table = unique(directory.back());
+                std::fill(table.begin() + (num_chunks & table_mask), table.end(), nullptr);
+            }
+            m_size = new_size;
+            return;
+        }
+        for (size_t i = m_size; i < new_size; i++)
+            push_back(T());
+    }
+
+    void clear()
+    {
+        m_directory.reset();
+        m_size = 0;
+    }
+
+    // Unshares the directory, every table and every chunk. Call this before writing to the
+    // container from several threads, after which mut() performs no allocation and distinct
+    // elements can be written concurrently.
+    void detach()
+    {
+        if (!m_directory)
+            return;
+        for (std::shared_ptr<Table>& table : unique_directory()) {
+            for (std::shared_ptr<Chunk>& chunk : unique(table)) {
+                if (chunk)
+                    unique(chunk);
+            }
+        }
+    }
+
+    // Number of chunks that are also referenced by another container.
+    size_t shared_chunk_count() const
+    {
+        size_t res = 0;
+        if (m_directory) {
+            for (const std::shared_ptr<Table>& table : *m_directory) {
+                for (const std::shared_ptr<Chunk>& chunk : *table) {
+                    if (chunk && (m_directory.use_count() > 1 || table.use_count() > 1 || chunk.use_count() > 1))
+                        res++;
+                }
+            }
+        }
+        return res;
+    }
+
+    std::vector<T> to_vector() const
+    {
+        return std::vector<T>(begin(), end());
+    }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, m_size); }
+
+private:
+    template<typename N>
+    static N& unique(std::shared_ptr<N>& node)
+    {
+        if (node.use_count() > 1)
+            node = std::make_shared<N>(*node);
+        return *node;
+    }
+
+    Directory& unique_directory()
+    {
+        if (!m_directory)
+            m_directory = std::make_shared<Directory>();
+        return unique(m_directory);
+    }
+
+    // Allocates the chunk with the given index, which must be the first one past the end
+    void add_chunk(size_t chunk_index)
+    {
+        Directory& directory = unique_directory();
+        if ((chunk_index & table_mask) == 0)
+            directory.push_back(std::make_shared<Table>());
+        unique(directory.back())[chunk_index & table_mask] = std::make_shared<Chunk>();
+    }
+
+    std::shared_ptr<Directory> m_directory;
+    size_t m_size = 0;
+};
+
+// Hash map stored as a persistent hash trie: every level consumes ChildBits of the key's hash
+// and leaves hold up to leaf_size entries. Nodes are held by shared pointers and shared between
+// copies, so copying is O(1) and a write after a copy clones only the nodes on the path to the
+// key, whose length grows with the logarithm of the map size. Readers never copy anything.
+template<typename K, typename V, typename Hash, int ChildBits = 5>
+class ChunkedMap
+{
+public:
+    static constexpr size_t child_count = size_t(1) << ChildBits;
+    static constexpr size_t child_mask = child_count - 1;
+    static constexpr size_t leaf_size = 16;
+    static constexpr int max_depth = 64 / ChildBits;
+
+    size_t size() const { return m_size; }
+
+    bool contains(const K& key) const
+    {
+        return find(key) != nullptr;
+    }
+
+    const V& at(const K& key) const
+    {
+        const V* value = find(key);
+        if (!value)
+            throw std::out_of_range("ChunkedMap::at");
+        return *value;
+    }
+
+    // Inserts value unless its key is already present, in which case nothing is copied.
+    bool insert(const std::pair<K, V>& value)
+    {
+        if (contains(value.first))
+            return false;
+
+        size_t hash = hash_of(value.first);
+        std::shared_ptr<Node>* slot = &m_root;
+        for (int depth = 0;; depth++) {
+            if (!*slot) {
+                *slot = std::make_shared<Node>();
+                (*slot)->entries.push_back(value);
+                break;
+            }
+            Node& node = unique(*slot);
+            if (node.leaf) {
+                node.entries.push_back(value);
+                if (node.entries.size() > leaf_size && depth < max_depth)
+                    split(node, depth);
+                break;
+            }
+            size_t bit = child_bit(hash, depth);
+            size_t pos = child_pos(node, bit);
+            if (!(node.bitmap & (uint64_t(1) << bit))) {
+                node.bitmap |= uint64_t(1) << bit;
+                node.children.insert(node.children.begin() + pos, nullptr);
+            }
+            slot = &node.children[pos];
+        }
+        m_size++;
+        return true;
+    }
+
+    bool erase(const K& key)
+    {
+        if (!contains(key))
+            return false;
+        if (erase(m_root, key, hash_of(key), 0))
+            m_root.reset();
+        m_size--;
+        return true;
+    }
+
+    void clear()
+    {
+        m_root.reset();
+        m_size = 0;
+    }
+
+private:
+    struct Node
+    {
+        bool leaf = true;
+        uint64_t bitmap = 0;
+        std::vector<std::shared_ptr<Node>> children;
+        std::vector<std::pair<K, V>> entries;
+    };
+
+    // Hash only needs to tell keys apart; mixing spreads it over the bits the trie consumes.
+    static size_t hash_of(const K& key)
+    {
+        uint64_t h = Hash()(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    static size_t child_bit(size_t hash, int depth) { return (hash >> (depth * ChildBits)) & child_mask; }
+
+    static size_t child_pos(const Node& node, size_t bit)
+    {
+        return std::popcount(node.bitmap & ((uint64_t(1) << bit) - 1));
+    }
+
+    static Node& unique(std::shared_ptr<Node>& node)
+    {
+        if (node.use_count() > 1)
+            node = std::make_shared<Node>(*node);
+        return *node;
+    }
+
+    // Turns an overfull leaf into an inner node, splitting again any child that is still overfull
+    static void split(Node& node, int depth)
+    {
+        std::vector<std::pair<K, V>> entries = std::move(node.entries);
+        node.entries.clear();
+        node.leaf = false;
+        for (const std::pair<K, V>& entry : entries) {
+            size_t bit = child_bit(hash_of(entry.first), depth);
+            size_t pos = child_pos(node, bit);
+            if (!(node.bitmap & (uint64_t(1) << bit))) {
+                node.bitmap |= uint64_t(1) << bit;
+                node.children.insert(node.children.begin() + pos, std::make_shared<Node>());
+            }
+            node.children[pos]->entries.push_back(entry);
+        }
+        for (std::shared_ptr<Node>& child : node.children) {
+            if (child->entries.size() > leaf_size && depth + 1 < max_depth)
+                split(*child, depth + 1);
+        }
+    }
+
+    const V* find(const K& key) const
+    {
+        size_t hash = hash_of(key);
+        const Node* node = m_root.get();
+        for (int depth = 0; node; depth++) {
+            if (node->leaf) {
+                for (const std::pair<K, V>& entry : node->entries) {
+                    if (entry.first == key)
+                        return &entry.second;
+                }
+                return nullptr;
+            }
+            size_t bit = child_bit(hash, depth);
+            if (!(node->bitmap & (uint64_t(1) << bit)))
+                return nullptr;
+            node = node->children[child_pos(*node, bit)].get();
+        }
+        return nullptr;
+    }
+
+    // Removes a key known to be present. Returns true if the node is left empty, in which case
+    // the caller drops it.
+    static bool erase(std::shared_ptr<Node>& slot, const K& key, size_t hash, int depth)
+    {
+        Node& node = unique(slot);
+        if (node.leaf) {
+            for (size_t i = 0; i < node.entries.size(); i++) {
+                if (node.entries[i].first == key) {
+                    node.entries.erase(node.entries.begin() + i);
+                    break;
+                }
+            }
+            return node.entries.empty();
+        }
+        size_t bit = child_bit(hash, depth);
+        size_t pos = child_pos(node, bit);
+        if (erase(node.children[pos], key, hash, depth + 1)) {
+            node.children.erase(node.children.begin() + pos);
+            node.bitmap &= ~(uint64_t(1) << bit);
+        }
+        return node.children.empty();
+    }
+
+    std::shared_ptr<Node> m_root;
+    size_t m_size = 0;
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Calls fn(begin, end) for contiguous sub-ranges of [0, count), one per hardware thread. The
+// calling thread processes the first range itself. Ranges are never smaller than min_per_thread,
+// so small inputs run inline without starting any thread. fn must not throw.
+template<typename Fn>
+void parallel_for(size_t count, Fn&& fn, size_t min_per_thread = 1024)
+{
+    size_t num_threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    num_threads = std::min(num_threads, std::max<size_t>(1, count / std::max<size_t>(1, min_per_thread)));
+    if(num_threads <= 1)
+    {
+        if(count > 0)
+            fn(size_t(0), count);
+        return;
+    }
+
+    size_t per_thread = (count + num_threads - 1) / num_threads;
+    std::vector<std::thread> threads;
+    for(size_t begin = per_thread; begin < count; begin += per_thread)
+    {
+        size_t end = std::min(count, begin + per_thread);
+        threads.emplace_back([&fn, begin, end]() { fn(begin, end); });
+    }
+    fn(size_t(0), per_thread);
+    for(std::thread& thread : threads)
+        thread.join();
+}
+
+// Worker threads that stay alive across parallel_for calls, for algorithms that run many small
+// parallel steps, where starting threads for every step would cost more than the step itself.
+// parallel_for splits the range the same way as the free function above, with the calling thread
+// taking part. It must not be called from inside one of its own tasks.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(size_t num_threads = std::max<size_t>(1, std::thread::hardware_concurrency()))
+    {
+        for(size_t i = 1; i < num_threads; i++)
+            m_threads.emplace_back([this]() { worker(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for(std::thread& thread : m_threads)
+            thread.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return m_threads.size() + 1; }
+
+    template<typename Fn>
+    void parallel_for(size_t count, Fn&& fn, size_t min_per_thread = 1024)
+    {
+        size_t num_tasks = std::min(size(), std::max<size_t>(1, count / std::max<size_t>(1, min_per_thread)));
+        if(num_tasks <= 1)
+        {
+            if(count > 0)
+                fn(size_t(0), count);
+            return;
+        }
+
+        size_t per_task = (count + num_tasks - 1) / num_tasks;
+        std::function<void(size_t)> task = [&fn, count, per_task](size_t t) {
+            size_t begin = t * per_task;
+            size_t end = std::min(count, begin + per_task);
+            if(begin < end)
+                fn(begin, end);
+        };
+        run(task, num_tasks);
+    }
+
+private:
+    void run(const std::function<void(size_t)>& task, size_t num_tasks)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_task = &task;
+            m_num_tasks = num_tasks;
+            m_next_task = 0;
+            m_unfinished = num_tasks;
+            m_generation++;
+        }
+        m_wake.notify_all();
+        work();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this]() { return m_unfinished == 0; });
+        m_task = nullptr;
+    }
+
+    // Takes tasks from the current batch until none are left
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while(m_task && m_next_task < m_num_tasks)
+        {
+            const std::function<void(size_t)>* task = m_task;
+            size_t t = m_next_task++;
+            lock.unlock();
+            (*task)(t);
+            lock.lock();
+            if(--m_unfinished == 0)
+                m_done.notify_all();
+        }
+    }
+
+    void worker()
+    {
+        uint64_t seen_generation = 0;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while(true)
+        {
+            m_wake.wait(lock, [&]() { return m_stop || m_generation != seen_generation; });
+            if(m_stop)
+                return;
+            seen_generation = m_generation;
+            lock.unlock();
+            work();
+            lock.lock();
+        }
+    }
+
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    const std::function<void(size_t)>* m_task = nullptr;
+    size_t m_num_tasks = 0;
+    size_t m_next_task = 0;
+    size_t m_unfinished = 0;
+    uint64_t m_generation = 0;
+    bool m_stop = false;
+};
@@ -0,0 +1,68 @@
+"""Reports how much BSP.simplify() shrinks a fragmented model, and how much faster the operations
+that follow it run. Not collected by pytest; run it directly:
+
+    python tests/bench_simplify.py --size 60
+"""
+
+import argparse
+import time
+
+import cadpy as cp
+
+# Same fragmented cube the simplify tests use; this script's directory is on sys.path when run directly
+from test_cadpy import make_subdivided_cube
+
+
+def best_time(fn, repeats):
+    best = float("inf")
+    for _ in range(repeats):
+        start = time.perf_counter()
+        fn()
+        best = min(best, time.perf_counter() - start)
+    return best
+
+
+def consume_chunks(bsp):
+    for chunk in bsp.to_tri_mesh_chunks(polygons_per_chunk=4096):
+        pass
+
+
+def split_snapshot(bsp, plane):
+    bsp.snapshot().split(plane)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--size", type=int, default=60, help="quads along each cube edge")
+    parser.add_argument("--repeats", type=int, default=5, help="runs per timing, best is kept")
+    args = parser.parse_args()
+
+    plane = cp.Plane()
+    plane.normal = cp.float3(1, 0, 0)
+    plane.d = args.size / 2 + 0.5
+
+    operations = {
+        "to_tri_mesh": lambda bsp: bsp.to_tri_mesh(),
+        "to_tri_mesh_chunks": consume_chunks,
+        "split": lambda bsp: split_snapshot(bsp, plane),
+    }
+
+    bsp = make_subdivided_cube(args.size)
+    before = {name: best_time(lambda: fn(bsp), args.repeats) for name, fn in operations.items()}
+    num_polygons = len(bsp.polygons)
+    num_half_edges = len(bsp.half_edges)
+
+    start = time.perf_counter()
+    bsp.simplify()
+    simplify_time = time.perf_counter() - start
+    after = {name: best_time(lambda: fn(bsp), args.repeats) for name, fn in operations.items()}
+
+    print(f"polygons:   {num_polygons} -> {len(bsp.polygons)} ({num_polygons / len(bsp.polygons):.1f}x fewer)")
+    print(f"half edges: {num_half_edges} -> {len(bsp.half_edges)} ({num_half_edges / len(bsp.half_edges):.1f}x fewer)")
+    print(f"simplify:   {simplify_time * 1000:.2f} ms")
+    for name in operations:
+        print(f"{name + ':':20s}{before[name] * 1000:9.3f} ms -> {after[name] * 1000:9.3f} ms ({before[name] / after[name]:.1f}x faster)")
+
+
+if __name__ == "__main__":
+    main()
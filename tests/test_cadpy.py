@@ -31,6 +31,11 @@ def test_create_cube():
     unique_twins = set([x.twin for x in half_edges])
     assert len(unique_twins) == len(half_edges)
 
+    # The element arrays are read-only sequences over the BSP's storage
+    assert cube.half_edges[-1].polygon.i == 5
+    with pytest.raises(IndexError):
+        cube.polygons[6]
+
 def test_cube_mesh():
     cube = cp.BSP.cube(cp.float3(1, 2, 3))
     mesh = cube.to_tri_mesh()
@@ -44,5 +49,280 @@ def test_cube_mesh():
     # Check all indices are in range
     assert all([0 <= x < len(mesh.positions) for x in mesh.indices])
 
+def make_subdivided_cube(n):
+    # Unit cube of size n with every face split into n x n quads
+    bsp = cp.BSP()
+    vertices = {}
+
+    def vertex(p):
+        if p not in vertices:
+            vertices[p] = bsp.create_vertex(cp.float3(*p))
+        return vertices[p]
+
+    for a in range(3):
+        b = (a + 1) % 3
+        c = (a + 2) % 3
+        for side in [0, n]:
+            for u in range(n):
+                for w in range(n):
+                    quad = []
+                    for du, dw in [(0, 0), (1, 0), (1, 1), (0, 1)]:
+                        p = [0, 0, 0]
+                        p[a] = side
+                        p[b] = u + du
+                        p[c] = w + dw
+                        quad.append(vertex(tuple(p)))
+                    if side == 0:
+                        quad.reverse()
+                    bsp.create_polygon(quad)
+    return bsp
+
+def polygon_positions(bsp):
+    # Positions around the loop of every polygon
+    half_edges = bsp.half_edges
+    positions = np.array([[v.position.x, v.position.y, v.position.z] for v in bsp.vertices])
+    loops = []
+    for polygon in bsp.polygons:
+        loop = []
+        e = polygon.edge.i
+        while True:
+            loop.append(half_edges[e].vertex.i)
+            e = half_edges[e].next.i
+            if e == polygon.edge.i:
+                break
+        loops.append(positions[loop])
+    return loops
+
+def newell_normal(positions):
+    normal = np.sum(np.cross(positions, np.roll(positions, -1, axis=0)), axis=0)
+    return normal / np.linalg.norm(normal)
+
+def test_simplify():
+    bsp = make_subdivided_cube(3)
+    assert len(bsp.polygons) == 54
+
+    removed = bsp.simplify()
+    assert removed == 48
+
+    # Only the cube's faces and corners remain, still fully connected
+    assert len(bsp.vertices) == 8
+    assert len(bsp.half_edges) == 24
+    assert len(bsp.polygons) == 6
+    assert all([x.twin.i >= 0 for x in bsp.half_edges])
+
+    mesh = bsp.to_tri_mesh()
+    assert mesh.indices.shape == (36,)
+
+def test_simplify_curved_strip():
+    # Neighbouring quads of a gently curved strip are each nearly coplanar, but the strip as a
+    # whole is far from flat and must not be merged into a single face
+    bsp = cp.BSP()
+    radius = 10
+    bottom = []
+    top = []
+    for i in range(101):
+        angle = math.radians(i * 0.23)
+        x = radius * math.cos(angle)
+        y = radius * math.sin(angle)
+        bottom.append(bsp.create_vertex(cp.float3(x, y, 0)))
+        top.append(bsp.create_vertex(cp.float3(x, y, 1)))
+    for i in range(100):
+        bsp.create_polygon([bottom[i], bottom[i + 1], top[i + 1], top[i]])
+
+    bsp.simplify()
+    assert len(bsp.polygons) > 1
+
+    for positions in polygon_positions(bsp):
+        distances = (positions - positions.mean(axis=0)) @ newell_normal(positions)
+        assert np.abs(distances).max() < 1e-3
+
+def test_convex_hull():
+    # Box corners plus a cloud of points strictly inside the box
+    rng = np.random.default_rng(0)
+    corners = np.array([[x, y, z] for x in (0, 1) for y in (0, 2) for z in (0, 3)], dtype=np.float32)
+    interior = (rng.uniform(0.01, 0.99, (1000, 3)) * [1, 2, 3]).astype(np.float32)
+    hull = cp.BSP.convex_hull(np.concatenate([interior, corners]))
+
+    # Coplanar triangles are merged, giving the same topology as BSP.cube
+    assert len(hull.vertices) == 8
+    assert len(hull.half_edges) == 24
+    assert len(hull.polygons) == 6
+    assert all([x.twin.i >= 0 for x in hull.half_edges])
+
+    sum_pos = sum([x.position for x in hull.vertices], start=cp.float3())
+    assert cp.float3.similar(sum_pos / 8, cp.float3(0.5, 1, 1.5))
+
+    with pytest.raises(ValueError):
+        cp.BSP.convex_hull(np.zeros((10, 3), dtype=np.float32))
+
+    # Merged faces of a curved hull stay flat, so no input point ends up noticeably outside
+    sphere = rng.normal(size=(5000, 3))
+    sphere = (100 * sphere / np.linalg.norm(sphere, axis=1, keepdims=True)).astype(np.float32)
+    hull = cp.BSP.convex_hull(sphere)
+    normals = []
+    centres = []
+    for p in polygon_positions(hull):
+        normal = newell_normal(p)
+        centre = p.mean(axis=0)
+        assert np.abs((p - centre) @ normal).max() < 5e-3
+        normals.append(normal)
+        centres.append(centre)
+    normals = np.array(normals)
+    offsets = np.sum(normals * np.array(centres), axis=1)
+    assert (sphere[::10] @ normals.T - offsets).max() < 5e-3
+
+def test_convex_hull_noisy_box():
+    # Points scattered over the faces of a box and jittered by far less than the hull's tolerance,
+    # so many are nearly coplanar with several faces at once. No face may fold inwards, and every
+    # input point must lie inside the hull or within about the tolerance of its faces.
+    rng = np.random.default_rng(3)
+    for jitter in [1e-5, 1e-6]:
+        for _ in range(4):
+            points = rng.uniform(-5, 5, (5000, 3))
+            points[np.arange(5000), rng.integers(0, 3, 5000)] = rng.choice([-5.0, 5.0], 5000)
+            points = (points + rng.uniform(-jitter, jitter, points.shape)).astype(np.float32)
+            epsilon = 1e-5 * np.linalg.norm(points.max(axis=0) - points.min(axis=0))
+
+            hull = cp.BSP.convex_hull(points)
+            for p in polygon_positions(hull):
+                normal = newell_normal(p)
+                offset = normal @ p.mean(axis=0)
+                assert offset > 0
+                assert (points @ normal - offset).max() < 2 * epsilon
+
+def test_convex_hull_collinear():
+    # Rings of a cylinder put several points on every straight side edge. Only the ends of each
+    # edge stay as corners, so every face yields a proper normal.
+    angles = np.linspace(0, 2 * np.pi, 64, endpoint=False)
+    points = np.array([[10 * math.cos(a), 10 * math.sin(a), z] for z in np.linspace(0, 10, 5) for a in angles], dtype=np.float32)
+    hull = cp.BSP.convex_hull(points)
+    assert len(hull.vertices) == 128
+    assert len(hull.polygons) == 66
+    assert all([x.twin.i >= 0 for x in hull.half_edges])
+
+    mesh = hull.to_tri_mesh()
+    assert np.all(np.isfinite(mesh.normals))
+    assert np.abs(np.linalg.norm(mesh.normals, axis=1) - 1).max() < 1e-4
+
+def test_snapshot():
+    bsp = cp.BSP()
+    v0 = bsp.create_vertex(cp.float3(0, 0, 0))
+    v1 = bsp.create_vertex(cp.float3(1, 0, 0))
+    v2 = bsp.create_vertex(cp.float3(0, 1, 0))
+    v3 = bsp.create_vertex(cp.float3(0, 0, 1))
+    bsp.create_polygon([v0, v2, v1])
+    bsp.create_polygon([v0, v1, v3])
+
+    snap = bsp.snapshot()
+    bsp.create_polygon([v1, v2, v3])
+    bsp.create_polygon([v0, v3, v2])
+
+    # The snapshot keeps the state from before the edits
+    assert len(snap.polygons) == 2
+    assert len(snap.half_edges) == 6
+    assert len(bsp.polygons) == 4
+    assert len(bsp.half_edges) == 12
+
+    assert len(bsp.vertices) == len(snap.vertices) == 4
+
+    # Edits to the snapshot don't leak back into the original
+    snap.create_vertex(cp.float3(1, 1, 1))
+    assert len(snap.vertices) == 5
+    assert len(bsp.vertices) == 4
+
+def test_tri_mesh_chunks():
+    bsp = make_subdivided_cube(3)
+    full = bsp.to_tri_mesh()
+
+    stream = bsp.to_tri_mesh_chunks(polygons_per_chunk=5)
+    assert len(stream) == 11
+
+    # Edits made while streaming don't show up in the stream
+    assert bsp.simplify() == 48
+
+    positions = []
+    indices = []
+    for chunk in stream:
+        # Every chunk indexes its own positions only
+        assert len(chunk.indices) > 0
+        assert chunk.indices.max() < len(chunk.positions)
+        indices.append(chunk.indices + sum([len(x) for x in positions]))
+        positions.append(chunk.positions.copy())
+
+    assert np.array_equal(np.concatenate(positions), full.positions)
+    assert np.array_equal(np.concatenate(indices), full.indices)
+
+def test_delete_and_compact():
+    bsp = cp.BSP.cube(cp.float3(1, 2, 3))
+    loop = [x.vertex for x in bsp.half_edges if x.polygon.i == 0]
+
+    # Deleted slots stay in place as tombstones and the neighbours become open
+    bsp.delete_polygon(bsp.half_edges[0].polygon)
+    assert len(bsp.polygons) == 6
+    assert bsp.polygons[0].edge.i == -1
+    assert len([x for x in bsp.half_edges if x.polygon.i == -1]) == 4
+    assert len([x for x in bsp.half_edges if x.polygon.i >= 0 and x.twin.i < 0]) == 4
+    assert len(bsp.to_tri_mesh().indices) == 30
+
+    # Indices read off tombstones are rejected without using up the free slots
+    tombstone = [x.vertex for x in bsp.half_edges if x.polygon.i == -1][0]
+    assert tombstone.i == -1
+    with pytest.raises(ValueError):
+        bsp.create_polygon(loop[:3] + [tombstone])
+
+    # Recreating the face reuses the free slots and closes the mesh again
+    bsp.create_polygon(loop)
+    assert len(bsp.polygons) == 6
+    assert len(bsp.half_edges) == 24
+    assert all([x.twin.i >= 0 for x in bsp.half_edges])
+
+    bsp.delete_polygon(bsp.half_edges[0].polygon)
+    bsp.delete_polygon(bsp.half_edges[12].polygon)
+    unused = bsp.create_vertex(cp.float3(5, 5, 5))
+    bsp.compact()
+    assert len(bsp.vertices) == 8
+
+    # Compacting drops the unused vertex, so its index now points past the end
+    with pytest.raises(ValueError):
+        bsp.create_polygon(loop[:3] + [unused])
+    assert len(bsp.half_edges) == 16
+    assert len(bsp.half_edges) == 16
+    assert len(bsp.polygons) == 4
+
+    # Every loop is stored contiguously, in polygon order
+    for i, polygon in enumerate(bsp.polygons):
+        assert polygon.edge.i == i * 4
+        for j in range(4):
+            assert bsp.half_edges[i * 4 + j].polygon.i == i
+            assert bsp.half_edges[i * 4 + j].next.i == i * 4 + (j + 1) % 4
+
+def test_double_precision():
+    # Box far from the origin, where float32 can't tell the corners apart
+    corners = np.array([[x, y, z] for x in (0, 1) for y in (0, 2) for z in (0, 3)], dtype=np.float64) + 1e8
+    hull = cp.BSPd.convex_hull(corners)
+
+    assert len(hull.vertices) == 8
+    assert len(hull.half_edges) == 24
+    assert len(hull.polygons) == 6
+
+    sum_pos = sum([x.position for x in hull.vertices], start=cp.double3())
+    assert cp.double3.similar(sum_pos / 8, cp.double3(1e8 + 0.5, 1e8 + 1, 1e8 + 1.5))
+
+    with pytest.raises(ValueError):
+        cp.BSP.convex_hull(corners.astype(np.float32))
+
+    bsp = cp.BSPd.cube(cp.double3(1, 2, 3))
+    assert len(bsp.vertices) == 8
+    assert len(bsp.polygons) == 6
+    assert len(bsp.to_tri_mesh().indices) == 36
+
+    # 64-bit indices take the same geometry
+    hull = cp.BSPd64.convex_hull(corners)
+    assert len(hull.vertices) == 8
+    assert len(hull.half_edges) == 24
+    assert len(hull.polygons) == 6
+    assert all([x.twin.i >= 0 for x in hull.half_edges])
+    assert isinstance(hull.half_edges[0].vertex, cp.VIdx64)
+
 if __name__ == "__main__":
     pytest.main([__file__, "-v", "-s"])